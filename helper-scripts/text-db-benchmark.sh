@@ -0,0 +1,87 @@
+#!/bin/bash
+# This script generates a test collection and measures text-db with it
+# GPLv3 or later
+# Depends on awk and a Linux /proc file system
+# Usage: ./text-db-benchmark.sh generate file [number of images]
+#        ./text-db-benchmark.sh dedup path/to/text-db file
+#        ./text-db-benchmark.sh diff path/to/text-db file
+
+# a collection like the one of text-db-image-scraper.sh: 5 items per image,
+# the format and modified values repeat, width and height mostly don't
+generate()
+{
+	awk -v images="${2:-200000}" 'BEGIN {
+		srand( 1 )
+		for( i = 0; i < images; i++ )
+		{
+			printf "img%06d\tvalue%d\n", i, i
+			printf "\twidth\t%d\n", 100 + int( rand() * 7900 )
+			printf "\theight\t%d\n", 100 + int( rand() * 7900 )
+			printf "\tformat\tjpg\n"
+			printf "\tmodified\t2020-%02d-%02d\n", i % 9 + 1, i % 9 + 10
+		}
+	}' > "$1"
+}
+
+# resident memory of text-db after running the commands in $2
+memory_after()
+{
+	local dir=`mktemp -d`
+	touch "$dir/empty"
+	mkfifo "$dir/input"
+
+	"$1" "$dir/empty" < "$dir/input" > "$dir/output" &
+	local pid=$!
+	exec 3> "$dir/input"
+
+	# count marks the end of the commands
+	printf "$2count\n" >&3
+	until grep -q "including subitems" "$dir/output" 2> /dev/null || ! kill -0 $pid 2> /dev/null
+	do
+		sleep 0.1
+	done
+
+	grep VmRSS "/proc/$pid/status"
+
+	exec 3>&-
+	wait $pid
+	rm -r "$dir"
+}
+
+# time of a diff of the collection in $2 with a copy of it that has every 100th width changed,
+# both saved by text-db so that they are in key order
+diff_time()
+{
+	local dir=`mktemp -d`
+	"$1" "$2" "save $dir/current" > /dev/null
+	awk '/^\twidth\t/ && ++n % 100 == 0 { $0 = $0 "0" } { print }' "$dir/current" > "$dir/old"
+
+	local start=`date +%s%N`
+	"$1" "$dir/current" count > /dev/null
+	local loaded=`date +%s%N`
+	"$1" "$dir/current" "diff $dir/old" > /dev/null
+	local end=`date +%s%N`
+
+	echo "load: $(( ( loaded - start ) / 1000000 )) ms," \
+		"diff: $(( ( end - loaded - ( loaded - start ) ) / 1000000 )) ms on top of the load"
+	rm -r "$dir"
+}
+
+case "$1" in
+	generate)
+		generate "$2" "$3"
+		;;
+	dedup)
+		echo "dedup off:" `memory_after "$2" "open $3\n"`
+		echo "dedup on: " `memory_after "$2" "option dedup on\nopen $3\n"`
+		;;
+	diff)
+		diff_time "$2" "$3"
+		;;
+	*)
+		echo "Usage: $0 generate file [number of images]"
+		echo "       $0 dedup path/to/text-db file"
+		echo "       $0 diff path/to/text-db file"
+		exit 1
+		;;
+esac
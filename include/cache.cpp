@@ -0,0 +1,105 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+// Member functions for query_cache
+
+#include "cache.h"
+
+std::shared_ptr< const std::string > query_cache::find( const std::string& query, uint64_t generation )
+{
+	std::lock_guard< std::mutex > lock( _mutex );
+	check_generation( generation );
+	
+	auto entry = _index.find( query );
+	if( entry == _index.end() )
+		return nullptr;
+	
+	// move to the front
+	_entries.splice( _entries.begin(), _entries, entry->second );
+	return entry->second->second;
+}
+
+void query_cache::insert( const std::string& query, uint64_t generation, std::shared_ptr< const std::string > result )
+{
+	std::lock_guard< std::mutex > lock( _mutex );
+	check_generation( generation );
+	
+	if( result->size() > _max_size || _index.find( query ) != _index.end() )
+		return;
+	
+	// drop least recently used results
+	while( _size + result->size() > _max_size && !_entries.empty() )
+	{
+		_size -= _entries.back().second->size();
+		_index.erase( _entries.back().first );
+		_entries.pop_back();
+	}
+	
+	_size += result->size();
+	_entries.emplace_front( query, std::move( result ) );
+	_index.emplace( query, _entries.begin() );
+}
+
+void query_cache::clear()
+{
+	std::lock_guard< std::mutex > lock( _mutex );
+	_entries.clear();
+	_index.clear();
+	_size = 0;
+}
+
+void query_cache::check_generation( uint64_t generation )
+{
+	if( generation == _generation )
+		return;
+	
+	_entries.clear();
+	_index.clear();
+	_size = 0;
+	_generation = generation;
+}
+
+query_cache::recorder::int_type query_cache::recorder::overflow( int_type c )
+{
+	if( traits_type::eq_int_type( c, traits_type::eof() ) )
+		return traits_type::not_eof( c );
+	
+	char ch = traits_type::to_char_type( c );
+	return ( xsputn( &ch, 1 ) == 1 ) ? c : traits_type::eof();
+}
+
+std::streamsize query_cache::recorder::xsputn( const char* s, std::streamsize count )
+{
+	copy( s, count );
+	return _output->sputn( s, count );
+}
+
+void query_cache::recorder::copy( const char* data, size_t size )
+{
+	// keep the copy while it fits into the cache
+	if( _dropped )
+		return;
+	
+	if( _result.size() + size <= _max_size )
+		_result.append( data, size );
+	else
+	{
+		_dropped = true;
+		std::string().swap( _result );
+	}
+}
@@ -0,0 +1,120 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+// Query result cache header
+
+#ifndef TEXTDB_CACHE
+#define TEXTDB_CACHE
+
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+
+#include "writer.h"
+
+/** Stores the output of read only commands for one database generation
+ * (see textdb::generation()). All results are dropped when the generation
+ * changes, the least recently used results are dropped when the size
+ * limit is reached. Can be used by several threads.
+ */
+class query_cache
+{
+	
+	public:
+		
+		/// \arg max_size maximum total size of all stored results in bytes
+		explicit query_cache( size_t max_size = 64 << 20 ) : _max_size( max_size ) {}
+		
+		/// Returns the stored result of query, nullptr if there is none
+		std::shared_ptr< const std::string > find( const std::string& query, uint64_t generation );
+		
+		/// Stores the result of query
+		void insert( const std::string& query, uint64_t generation, std::shared_ptr< const std::string > result );
+		
+		/// Drops all results
+		void clear();
+		
+		/// Maximum total size of all stored results in bytes
+		size_t max_size() const { return _max_size; }
+		
+		class recorder;
+		
+	private:
+		
+		/// Results stay valid while they are used, even if they are dropped
+		typedef std::list< std::pair< std::string, std::shared_ptr< const std::string > > > entry_list;
+		
+		std::mutex _mutex;
+		
+		/// Query and result, most recently used first
+		entry_list _entries;
+		
+		/// Query → entry
+		std::unordered_map< std::string, entry_list::iterator > _index;
+		
+		/// Generation of the stored results
+		uint64_t _generation = 0;
+		
+		size_t _size = 0, _max_size;
+		
+		/// Drops all results if generation is different from _generation
+		void check_generation( uint64_t generation );
+		
+};
+
+/** Stream buffer that passes all output on to another stream buffer and
+ * keeps a copy of it for the cache, the copy is dropped when it gets
+ * larger than max_size
+ */
+class query_cache::recorder : public tee_buffer
+{
+	
+	public:
+		
+		recorder( std::streambuf* output, size_t max_size ) : _output( output ), _max_size( max_size ) {}
+		
+		/// Is the copy of the output complete
+		bool complete() const { return !_dropped; }
+		
+		/// The copy of the output, empty if it was dropped
+		std::string& result() { return _result; }
+		
+		std::streambuf* target() const override { return _output; }
+		void copy( const char* data, size_t size ) override;
+		
+	protected:
+		
+		int_type overflow( int_type c ) override;
+		std::streamsize xsputn( const char* s, std::streamsize count ) override;
+		int sync() override { return _output->pubsync(); }
+		
+	private:
+		
+		std::streambuf* _output;
+		size_t _max_size;
+		
+		std::string _result;
+		bool _dropped = false;
+		
+};
+
+#endif
@@ -0,0 +1,562 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+// Compressed file streams
+
+#include "compress.h"
+
+#include <vector>
+#include <stdexcept>
+
+#include <zlib.h>
+
+#ifdef TEXTDB_ZSTD
+#include <zstd.h>
+#endif
+
+compression detect_compression( const std::string& filename )
+{
+	std::ifstream file( filename, std::ios::binary );
+	unsigned char magic[4] = { 0, 0, 0, 0 };
+	file.read( (char*)magic, sizeof( magic ) );
+	
+	if( file.gcount() >= 2 && magic[0] == 0x1f && magic[1] == 0x8b )
+		return compression::gzip;
+	if( file.gcount() == 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd )
+		return compression::zstd;
+	
+	return compression::none;
+}
+
+compression compression_for_name( const std::string& filename )
+{
+	auto ends_with = [&filename]( const std::string& extension )
+	{
+		return filename.size() > extension.size() && filename.compare( filename.size()-extension.size(), extension.size(), extension ) == 0;
+	};
+	
+	if( ends_with( ".gz" ) )
+		return compression::gzip;
+	if( ends_with( ".zst" ) )
+		return compression::zstd;
+	
+	return compression::none;
+}
+
+bool compression_supported( compression format )
+{
+#ifdef TEXTDB_ZSTD
+	(void)format;
+	return true;
+#else
+	return format != compression::zstd;
+#endif
+}
+
+std::string strip_compression_extension( const std::string& filename )
+{
+	switch( compression_for_name( filename ) )
+	{
+		case compression::gzip:
+			return filename.substr( 0, filename.size()-3 );
+		case compression::zstd:
+			return filename.substr( 0, filename.size()-4 );
+		default:
+			return filename;
+	}
+}
+
+// codecs
+
+/// Decompresses gzip (and zlib) data, concatenated gzip files are read as one
+class gzip_decoder : public codec
+{
+	
+	public:
+		
+		gzip_decoder()
+		{
+			// 32: detect gzip or zlib header
+			if( inflateInit2( &_stream, 15 + 32 ) != Z_OK )
+				throw std::runtime_error( "Could not initialize zlib" );
+		}
+		
+		~gzip_decoder() { inflateEnd( &_stream ); }
+		
+		void process( const char* input, size_t size, std::string& output, bool finish ) override
+		{
+			char buffer[1 << 16];
+			_stream.next_in = (Bytef*)input;
+			_stream.avail_in = size;
+			
+			do
+			{
+				// next member of a concatenated file
+				if( _end && _stream.avail_in > 0 )
+				{
+					inflateReset( &_stream );
+					_end = false;
+				}
+				
+				_stream.next_out = (Bytef*)buffer;
+				_stream.avail_out = sizeof( buffer );
+				int result = inflate( &_stream, Z_NO_FLUSH );
+				if( result == Z_STREAM_END )
+					_end = true;
+				else if( result != Z_OK && result != Z_BUF_ERROR )
+					throw std::runtime_error( "Corrupt gzip data" );
+				
+				size_t produced = sizeof( buffer ) - _stream.avail_out;
+				output.append( buffer, produced );
+				
+				// more input is needed
+				if( result == Z_BUF_ERROR && produced == 0 )
+					break;
+			}
+			while( _stream.avail_in > 0 || _stream.avail_out == 0 );
+			
+			if( finish && !_end )
+				throw std::runtime_error( "Truncated gzip data" );
+		}
+		
+	private:
+		
+		z_stream _stream = z_stream();
+		
+		/// Is the end of a member reached
+		bool _end = false;
+		
+};
+
+/// Compresses data in the gzip format
+class gzip_encoder : public codec
+{
+	
+	public:
+		
+		gzip_encoder()
+		{
+			// 16: write a gzip header
+			if( deflateInit2( &_stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY ) != Z_OK )
+				throw std::runtime_error( "Could not initialize zlib" );
+		}
+		
+		~gzip_encoder() { deflateEnd( &_stream ); }
+		
+		void process( const char* input, size_t size, std::string& output, bool finish ) override
+		{
+			char buffer[1 << 16];
+			_stream.next_in = (Bytef*)input;
+			_stream.avail_in = size;
+			
+			do
+			{
+				_stream.next_out = (Bytef*)buffer;
+				_stream.avail_out = sizeof( buffer );
+				deflate( &_stream, finish ? Z_FINISH : Z_NO_FLUSH );
+				output.append( buffer, sizeof( buffer ) - _stream.avail_out );
+			}
+			while( _stream.avail_out == 0 );
+		}
+		
+	private:
+		
+		z_stream _stream = z_stream();
+		
+};
+
+#ifdef TEXTDB_ZSTD
+
+/// Decompresses zstd data
+class zstd_decoder : public codec
+{
+	
+	public:
+		
+		zstd_decoder() : _stream( ZSTD_createDStream() ), _buffer( ZSTD_DStreamOutSize() ) {}
+		~zstd_decoder() { ZSTD_freeDStream( _stream ); }
+		
+		void process( const char* input, size_t size, std::string& output, bool finish ) override
+		{
+			ZSTD_inBuffer in = { input, size, 0 };
+			ZSTD_outBuffer out;
+			
+			do
+			{
+				out = { _buffer.data(), _buffer.size(), 0 };
+				_remaining = ZSTD_decompressStream( _stream, &out, &in );
+				if( ZSTD_isError( _remaining ) )
+					throw std::runtime_error( "Corrupt zstd data" );
+				
+				output.append( _buffer.data(), out.pos );
+			}
+			while( in.pos < in.size || out.pos == out.size );
+			
+			if( finish && _remaining != 0 )
+				throw std::runtime_error( "Truncated zstd data" );
+		}
+		
+	private:
+		
+		ZSTD_DStream* _stream;
+		std::vector< char > _buffer;
+		
+		/// Result of the last call, 0 at the end of a frame
+		size_t _remaining = 0;
+		
+};
+
+/// Compresses data in the zstd format
+class zstd_encoder : public codec
+{
+	
+	public:
+		
+		zstd_encoder() : _context( ZSTD_createCCtx() ), _buffer( ZSTD_CStreamOutSize() ) {}
+		~zstd_encoder() { ZSTD_freeCCtx( _context ); }
+		
+		void process( const char* input, size_t size, std::string& output, bool finish ) override
+		{
+			ZSTD_inBuffer in = { input, size, 0 };
+			bool done;
+			
+			do
+			{
+				ZSTD_outBuffer out = { _buffer.data(), _buffer.size(), 0 };
+				size_t remaining = ZSTD_compressStream2( _context, &out, &in, finish ? ZSTD_e_end : ZSTD_e_continue );
+				if( ZSTD_isError( remaining ) )
+					throw std::runtime_error( "zstd compression failed" );
+				
+				output.append( _buffer.data(), out.pos );
+				done = finish ? ( remaining == 0 ) : ( in.pos == in.size );
+			}
+			while( !done );
+		}
+		
+	private:
+		
+		ZSTD_CCtx* _context;
+		std::vector< char > _buffer;
+		
+};
+
+#endif
+
+std::unique_ptr< codec > codec::create( compression format, bool compress )
+{
+	switch( format )
+	{
+		case compression::gzip:
+			if( compress )
+				return std::make_unique< gzip_encoder >();
+			return std::make_unique< gzip_decoder >();
+#ifdef TEXTDB_ZSTD
+		case compression::zstd:
+			if( compress )
+				return std::make_unique< zstd_encoder >();
+			return std::make_unique< zstd_decoder >();
+#endif
+		default:
+			return nullptr;
+	}
+}
+
+// block_queue
+
+bool block_queue::push( std::string&& block )
+{
+	std::unique_lock< std::mutex > lock( _mutex );
+	_changed.wait( lock, [this]{ return _closed || _blocks.size() < _max_size; } );
+	if( _closed )
+		return false;
+	
+	_blocks.push_back( std::move( block ) );
+	_changed.notify_all();
+	return true;
+}
+
+bool block_queue::pop( std::string& block )
+{
+	std::unique_lock< std::mutex > lock( _mutex );
+	_changed.wait( lock, [this]{ return _closed || !_blocks.empty(); } );
+	if( _blocks.empty() )
+		return false;
+	
+	block = std::move( _blocks.front() );
+	_blocks.pop_front();
+	_changed.notify_all();
+	return true;
+}
+
+void block_queue::close()
+{
+	std::lock_guard< std::mutex > lock( _mutex );
+	_closed = true;
+	_changed.notify_all();
+}
+
+// decompressing_buffer
+
+decompressing_buffer::decompressing_buffer( const std::string& filename, compression format ) :
+	_file( filename, std::ios::binary ), _codec( codec::create( format, false ) )
+{
+	if( !_file.is_open() )
+		return;
+	
+	if( !_codec )
+	{
+		_error = "The compression of " + filename + " is not supported by this build";
+		_file.close();
+		return;
+	}
+	
+	_open = true;
+	_thread = std::thread( &decompressing_buffer::run, this );
+}
+
+decompressing_buffer::~decompressing_buffer()
+{
+	// stops the thread if the data isn't read completely
+	_queue.close();
+	if( _thread.joinable() )
+		_thread.join();
+}
+
+std::string decompressing_buffer::error()
+{
+	std::lock_guard< std::mutex > lock( _error_mutex );
+	return _error;
+}
+
+decompressing_buffer::int_type decompressing_buffer::underflow()
+{
+	if( gptr() < egptr() )
+		return traits_type::to_int_type( *gptr() );
+	
+	// next block from the thread
+	do
+	{
+		if( !_queue.pop( _block ) )
+			return traits_type::eof();
+	}
+	while( _block.empty() );
+	
+	setg( &_block[0], &_block[0], &_block[0] + _block.size() );
+	return traits_type::to_int_type( *gptr() );
+}
+
+void decompressing_buffer::run()
+{
+	std::vector< char > input( 1 << 16 );
+	
+	try
+	{
+		while( _file )
+		{
+			_file.read( input.data(), input.size() );
+			
+			std::string output;
+			_codec->process( input.data(), _file.gcount(), output, !_file );
+			if( !output.empty() && !_queue.push( std::move( output ) ) )
+				return;
+		}
+	}
+	catch( std::exception& e )
+	{
+		std::lock_guard< std::mutex > lock( _error_mutex );
+		_error = e.what();
+	}
+	
+	_queue.close();
+}
+
+// compressing_buffer
+
+compressing_buffer::compressing_buffer( const std::string& filename, compression format ) :
+	_file( filename, std::ios::binary | std::ios::trunc ), _codec( codec::create( format, true ) )
+{
+	if( !_file.is_open() || !_codec )
+	{
+		_file.close();
+		_failed = true;
+		return;
+	}
+	
+	_block.resize( block_size );
+	setp( &_block[0], &_block[0] + _block.size() );
+	_open = true;
+	_thread = std::thread( &compressing_buffer::run, this );
+}
+
+bool compressing_buffer::close()
+{
+	if( !_thread.joinable() )
+		return !_failed;
+	
+	send();
+	_queue.close();
+	_thread.join();
+	setp( nullptr, nullptr );
+	
+	return !_failed;
+}
+
+compressing_buffer::int_type compressing_buffer::overflow( int_type c )
+{
+	send();
+	
+	if( !traits_type::eq_int_type( c, traits_type::eof() ) )
+	{
+		*pptr() = traits_type::to_char_type( c );
+		pbump( 1 );
+	}
+	
+	return traits_type::not_eof( c );
+}
+
+void compressing_buffer::send()
+{
+	size_t used = pptr() - pbase();
+	if( used == 0 )
+		return;
+	
+	_block.resize( used );
+	if( !_queue.push( std::move( _block ) ) )
+		_failed = true;
+	
+	_block = std::string( block_size, '\0' );
+	setp( &_block[0], &_block[0] + _block.size() );
+}
+
+void compressing_buffer::run()
+{
+	std::string block, output;
+	
+	try
+	{
+		while( _queue.pop( block ) )
+		{
+			output.clear();
+			_codec->process( block.data(), block.size(), output, false );
+			_file.write( output.data(), output.size() );
+		}
+		
+		output.clear();
+		_codec->process( nullptr, 0, output, true );
+		_file.write( output.data(), output.size() );
+		_file.close();
+		
+		if( !_file )
+			_failed = true;
+	}
+	catch( std::exception& )
+	{
+		_failed = true;
+		
+		// keep taking blocks, the writer would wait forever otherwise
+		while( _queue.pop( block ) )
+			;
+	}
+}
+
+// input_file
+
+input_file::input_file( const std::string& filename ) : std::istream( nullptr )
+{
+	compression format = detect_compression( filename );
+	
+	if( format == compression::none )
+	{
+		_open = _file.open( filename, std::ios::in | std::ios::binary ) != nullptr;
+		if( _open )
+			rdbuf( &_file );
+	}
+	else
+	{
+		_decompressor = std::make_unique< decompressing_buffer >( filename, format );
+		_open = _decompressor->is_open();
+		if( _open )
+			rdbuf( _decompressor.get() );
+		else
+			_error = _decompressor->error();
+	}
+	
+	if( !_open )
+		setstate( std::ios::failbit );
+}
+
+void input_file::close()
+{
+	if( _decompressor )
+	{
+		_error = _decompressor->error();
+		_decompressor.reset();
+	}
+	else
+		_file.close();
+	
+	rdbuf( nullptr );
+	_open = false;
+}
+
+std::string input_file::error()
+{
+	if( _decompressor )
+		return _decompressor->error();
+	
+	return _error;
+}
+
+// output_file
+
+output_file::output_file( const std::string& filename, compression format ) : std::ostream( nullptr )
+{
+	if( format == compression::none )
+	{
+		_open = _file.open( filename, std::ios::out | std::ios::trunc | std::ios::binary ) != nullptr;
+		if( _open )
+			rdbuf( &_file );
+	}
+	else
+	{
+		_compressor = std::make_unique< compressing_buffer >( filename, format );
+		_open = _compressor->is_open();
+		if( _open )
+			rdbuf( _compressor.get() );
+	}
+	
+	if( !_open )
+		setstate( std::ios::failbit );
+}
+
+bool output_file::close()
+{
+	if( !_open )
+		return false;
+	_open = false;
+	
+	flush();
+	bool written = !fail();
+	
+	if( _compressor )
+		written = _compressor->close() && written;
+	else
+		written = ( _file.close() != nullptr ) && written;
+	
+	return written;
+}
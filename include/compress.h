@@ -0,0 +1,227 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+// Compressed file streams header
+
+#ifndef TEXTDB_COMPRESS
+#define TEXTDB_COMPRESS
+
+#include <istream>
+#include <ostream>
+#include <fstream>
+#include <streambuf>
+#include <string>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+/// Compression formats of collection files
+enum class compression { none, gzip, zstd };
+
+/// Detects the compression of a file by its first bytes
+compression detect_compression( const std::string& filename );
+
+/// Returns the compression for a file name by its extension (.gz, .zst)
+compression compression_for_name( const std::string& filename );
+
+/// Checks if files with this compression can be read and written by this build
+bool compression_supported( compression format );
+
+/// Removes the extension of a compressed file name (.gz, .zst)
+std::string strip_compression_extension( const std::string& filename );
+
+/// Converts blocks of data, implemented for each compression format
+class codec
+{
+	
+	public:
+		
+		virtual ~codec() {}
+		
+		/** Converts size bytes of input and appends the result to output,
+		 * throws std::runtime_error for corrupt input
+		 * \arg finish no more input follows
+		 */
+		virtual void process( const char* input, size_t size, std::string& output, bool finish ) = 0;
+		
+		/** Creates a decompressor or a compressor
+		 * \returns nullptr for compression::none and formats not supported by this build
+		 */
+		static std::unique_ptr< codec > create( compression format, bool compress );
+		
+};
+
+/// Blocks of data passed from one thread to another, the number of waiting blocks is limited
+class block_queue
+{
+	
+	public:
+		
+		explicit block_queue( size_t max_size = 4 ) : _max_size( max_size ) {}
+		
+		/// Appends a block, waits while the queue is full, \returns false if the queue is closed
+		bool push( std::string&& block );
+		
+		/// Takes the first block, waits while the queue is empty, \returns false if it is empty and closed
+		bool pop( std::string& block );
+		
+		/// No more blocks follow, waiting calls return
+		void close();
+		
+	private:
+		
+		std::deque< std::string > _blocks;
+		size_t _max_size;
+		bool _closed = false;
+		std::mutex _mutex;
+		std::condition_variable _changed;
+		
+};
+
+/** Stream buffer that reads a compressed file, the file is read and
+ * decompressed on a background thread while the data is parsed
+ */
+class decompressing_buffer : public std::streambuf
+{
+	
+	public:
+		
+		decompressing_buffer( const std::string& filename, compression format );
+		~decompressing_buffer();
+		
+		bool is_open() const { return _open; }
+		
+		/// Error of the decompression, empty if there was none
+		std::string error();
+		
+	protected:
+		
+		int_type underflow() override;
+		
+	private:
+		
+		std::ifstream _file;
+		bool _open = false;
+		std::unique_ptr< codec > _codec;
+		block_queue _queue;
+		
+		/// The block being read
+		std::string _block;
+		
+		std::string _error;
+		std::mutex _error_mutex;
+		
+		std::thread _thread;
+		
+		/// Main function of the thread
+		void run();
+		
+};
+
+/** Stream buffer that writes a compressed file, the data is compressed
+ * and written on a background thread
+ */
+class compressing_buffer : public std::streambuf
+{
+	
+	public:
+		
+		compressing_buffer( const std::string& filename, compression format );
+		~compressing_buffer() { close(); }
+		
+		bool is_open() const { return _open; }
+		
+		/// Writes the rest of the data and closes the file, \returns false on errors
+		bool close();
+		
+	protected:
+		
+		int_type overflow( int_type c ) override;
+		
+	private:
+		
+		static const size_t block_size = 1 << 18;
+		
+		std::ofstream _file;
+		bool _open = false;
+		std::unique_ptr< codec > _codec;
+		block_queue _queue;
+		
+		/// The block being written
+		std::string _block;
+		
+		std::atomic< bool > _failed{ false };
+		std::thread _thread;
+		
+		/// Passes the written part of _block to the thread
+		void send();
+		
+		/// Main function of the thread
+		void run();
+		
+};
+
+/// Input file stream, compressed files are detected by their first bytes and decompressed
+class input_file : public std::istream
+{
+	
+	public:
+		
+		explicit input_file( const std::string& filename );
+		
+		bool is_open() const { return _open; }
+		void close();
+		
+		/// Why the file could not be opened or read, empty if there was no error
+		std::string error();
+		
+	private:
+		
+		std::filebuf _file;
+		std::unique_ptr< decompressing_buffer > _decompressor;
+		bool _open = false;
+		std::string _error;
+		
+};
+
+/// Output file stream, compressed if format isn't compression::none
+class output_file : public std::ostream
+{
+	
+	public:
+		
+		output_file( const std::string& filename, compression format );
+		~output_file() { close(); }
+		
+		bool is_open() const { return _open; }
+		
+		/// Writes the rest of the data and closes the file, \returns false on errors
+		bool close();
+		
+	private:
+		
+		std::filebuf _file;
+		std::unique_ptr< compressing_buffer > _compressor;
+		bool _open = false;
+		
+};
+
+#endif
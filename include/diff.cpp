@@ -0,0 +1,367 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+// Member functions for file_source, diff and merge
+
+#include "diff.h"
+#include "compress.h"
+
+#include <algorithm>
+
+namespace
+{
+	/// Thrown by the parse callback to stop parsing
+	struct stop_parsing {};
+	
+	/// Checks if two value lists have the same values, in any order
+	bool same_values( const textdb::values& a, const textdb::values& b )
+	{
+		if( a.size() != b.size() )
+			return false;
+		
+		for( auto& value : a )
+		{
+			if( !b.contains( value ) )
+				return false;
+		}
+		return true;
+	}
+	
+	/// Prints an item as a line of diff_items()
+	template< class value_range > void print_item( std::ostream& output, const char* mark, const textdb::keys& keys, const value_range& values, char delimiter )
+	{
+		output << mark << ' ';
+		for( size_t i = 0; i < keys.size(); i++ )
+		{
+			if( i )
+				output << delimiter;
+			output << keys[i];
+		}
+		
+		if( values.begin() != values.end() )
+		{
+			output << delimiter;
+			for( auto& value : values )
+				output << delimiter << value;
+		}
+		output << '\n';
+	}
+}
+
+file_source::file_source( const std::vector< std::string >& filenames, bool tsv ) :
+	_filenames( filenames ), _tsv( tsv )
+{
+	_thread = std::thread( &file_source::parse, this );
+}
+
+file_source::~file_source()
+{
+	// unblock the parser if it waits for a free slot
+	_cancelled = true;
+	for( textdb::item_batch rest; _batches.pop( rest ); );
+	_thread.join();
+}
+
+bool file_source::next()
+{
+	if( ++_position < _batch.size() )
+		return true;
+	
+	// only non-empty batches are queued
+	_position = 0;
+	return _batches.pop( _batch );
+}
+
+void file_source::parse()
+{
+	textdb parser;
+	textdb::item_batch batch;
+	batch.reserve( batch_size );
+	
+	// keys of the last queued item
+	textdb::keys last;
+	bool first = true;
+	
+	auto item = [&]( const textdb::keys& item_keys, textdb::values& item_values )
+	{
+		if( _cancelled )
+			throw stop_parsing();
+		
+		// the items have to be in strictly increasing order to be merged
+		if( !first && !( ( batch.empty() ? last : batch.back().first ) < item_keys ) )
+		{
+			_unsorted = true;
+			throw stop_parsing();
+		}
+		first = false;
+		
+		batch.emplace_back( item_keys, std::move( item_values ) );
+		if( batch.size() == batch_size )
+		{
+			last = batch.back().first;
+			_batches.push( std::move( batch ) );
+			batch.clear();
+			batch.reserve( batch_size );
+		}
+	};
+	
+	try
+	{
+		for( auto& filename : _filenames )
+		{
+			input_file input( filename );
+			if( !input.is_open() )
+			{
+				_error = input.error().empty() ? "Could not open " + filename : input.error();
+				break;
+			}
+			
+			textdb::keys temp_keys({""});
+			if( _tsv )
+				parser.parse_tsv( input, item );
+			else
+				parser.parse( input, temp_keys, item );
+			input.close();
+			
+			if( !input.error().empty() )
+			{
+				_error = input.error();
+				break;
+			}
+		}
+		
+		if( !batch.empty() )
+			_batches.push( std::move( batch ) );
+	}
+	catch( stop_parsing& )
+	{
+	}
+	catch( std::exception& e )
+	{
+		_error = e.what();
+	}
+	
+	_batches.close();
+}
+
+void held_output::release()
+{
+	if( !_released )
+	{
+		_output->sputn( _held.data(), _held.size() );
+		std::string().swap( _held );
+		_released = true;
+	}
+}
+
+held_output::int_type held_output::overflow( int_type c )
+{
+	if( traits_type::eq_int_type( c, traits_type::eof() ) )
+		return traits_type::not_eof( c );
+	
+	char ch = traits_type::to_char_type( c );
+	return ( xsputn( &ch, 1 ) == 1 ) ? c : traits_type::eof();
+}
+
+std::streamsize held_output::xsputn( const char* s, std::streamsize count )
+{
+	if( !_released )
+	{
+		if( _held.size() + count <= _max_size )
+		{
+			_held.append( s, count );
+			return count;
+		}
+		
+		release();
+	}
+	
+	return _output->sputn( s, count );
+}
+
+bool diff_items( item_source& current, item_source& old, char delimiter, std::ostream& output )
+{
+	std::vector< std::string > added, removed;
+	
+	// the rest of a source would look added or deleted if the other one stopped early
+	bool has_current = current.next(), has_old = old.next();
+	while( ( has_current || has_old ) && ( has_current || !current.stopped() ) && ( has_old || !old.stopped() ) )
+	{
+		if( !has_old || ( has_current && current.keys() < old.keys() ) )
+		{
+			print_item( output, "+", current.keys(), current.values(), delimiter );
+			has_current = current.next();
+		}
+		else if( !has_current || old.keys() < current.keys() )
+		{
+			print_item( output, "-", old.keys(), old.values(), delimiter );
+			has_old = old.next();
+		}
+		else
+		{
+			// same item, compare the values with hashed lookups
+			added.clear();
+			removed.clear();
+			for( auto& value : current.values() )
+			{
+				if( !old.values().contains( value ) )
+					added.push_back( value );
+			}
+			for( auto& value : old.values() )
+			{
+				if( !current.values().contains( value ) )
+					removed.push_back( value );
+			}
+			
+			if( !added.empty() )
+				print_item( output, "+=", current.keys(), added, delimiter );
+			if( !removed.empty() )
+				print_item( output, "-=", current.keys(), removed, delimiter );
+			
+			has_current = current.next();
+			has_old = old.next();
+		}
+	}
+	
+	return !current.unsorted() && !old.unsorted();
+}
+
+bool merge_items( item_source& ours, item_source& theirs, item_source& base, merge_result& result )
+{
+	static const textdb::values none;
+	
+	/* keys of the items of the result that the current item is a subitem of, from the top level,
+	 * and the index of each in result.erase if it is to be deleted, an item can only be deleted
+	 * if none of its subitems stay
+	 */
+	std::vector< std::string > path;
+	std::vector< size_t > path_erase;
+	static const size_t kept = size_t( -1 );
+	
+	bool has_ours = ours.next(), has_theirs = theirs.next(), has_base = base.next();
+	while( ( has_ours || has_theirs || has_base ) &&
+		( has_ours || !ours.stopped() ) && ( has_theirs || !theirs.stopped() ) && ( has_base || !base.stopped() ) )
+	{
+		// the smallest key of the three sources
+		const textdb::keys* keys = nullptr;
+		if( has_ours )
+			keys = &ours.keys();
+		if( has_theirs && ( !keys || theirs.keys() < *keys ) )
+			keys = &theirs.keys();
+		if( has_base && ( !keys || base.keys() < *keys ) )
+			keys = &base.keys();
+		
+		bool in_ours = has_ours && ours.keys() == *keys;
+		bool in_theirs = has_theirs && theirs.keys() == *keys;
+		bool in_base = has_base && base.keys() == *keys;
+		
+		const textdb::values& base_values = in_base ? base.values() : none;
+		
+		// the items of the result above the item
+		size_t depth = 0;
+		while( depth < path.size() && depth+1 < keys->size() && path[depth] == (*keys)[depth] )
+			depth++;
+		path.resize( depth );
+		path_erase.resize( depth );
+		bool has_parent = ( depth+1 == keys->size() );
+		
+		// the item is in the result and it is deleted if erase isn't kept
+		bool in_result = in_ours;
+		size_t erase = kept;
+		
+		if( in_theirs && !in_ours )
+		{
+			// added by them, or deleted by us and maybe changed by them
+			if( !in_base && has_parent )
+			{
+				result.assign.emplace_back( *keys, theirs.values() );
+				in_result = true;
+			}
+			else if( !in_base || !same_values( theirs.values(), base_values ) )
+				result.conflicts.push_back( *keys );
+		}
+		else if( in_ours && !in_theirs && in_base )
+		{
+			// deleted by them, maybe changed by us
+			if( same_values( ours.values(), base_values ) )
+			{
+				erase = result.erase.size();
+				result.erase.push_back( *keys );
+			}
+			else
+				result.conflicts.push_back( *keys );
+		}
+		else if( in_ours && in_theirs )
+		{
+			// keep our values that they haven't deleted, add the values they have added
+			bool changed = false;
+			textdb::values merged;
+			for( auto& value : ours.values() )
+			{
+				if( base_values.contains( value ) && !theirs.values().contains( value ) )
+					changed = true;
+				else
+					merged.push_back( value );
+			}
+			for( auto& value : theirs.values() )
+			{
+				if( !base_values.contains( value ) && !ours.values().contains( value ) )
+				{
+					merged.push_back( value );
+					changed = true;
+				}
+			}
+			
+			if( changed )
+				result.assign.emplace_back( *keys, std::move( merged ) );
+		}
+		
+		if( in_result && has_parent )
+		{
+			// an item that stays keeps the items above it
+			if( erase == kept )
+			{
+				for( size_t i = 0; i < depth; i++ )
+				{
+					if( path_erase[i] != kept )
+					{
+						result.conflicts.push_back( std::move( result.erase[path_erase[i]] ) );
+						result.erase[path_erase[i]].clear();
+						path_erase[i] = kept;
+					}
+				}
+			}
+			
+			path.push_back( keys->back() );
+			path_erase.push_back( erase );
+		}
+		
+		if( in_ours )
+			has_ours = ours.next();
+		if( in_theirs )
+			has_theirs = theirs.next();
+		if( in_base )
+			has_base = base.next();
+	}
+	
+	// items deleted by them that keep subitems are conflicts
+	result.erase.erase( std::remove_if( result.erase.begin(), result.erase.end(), []( const textdb::keys& keys ){ return keys.empty(); } ), result.erase.end() );
+	std::sort( result.conflicts.begin(), result.conflicts.end() );
+	
+	return !ours.unsorted() && !theirs.unsorted() && !base.unsorted();
+}
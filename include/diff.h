@@ -0,0 +1,202 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+// Diff and merge header
+
+#ifndef TEXTDB_DIFF
+#define TEXTDB_DIFF
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <streambuf>
+
+#include "textdb.h"
+#include "queue.h"
+
+/// Items in key order, read one at a time
+class item_source
+{
+	
+	public:
+		
+		virtual ~item_source() {}
+		
+		/// Moves to the next item, \returns false after the last item
+		virtual bool next() = 0;
+		
+		/// Keys of the current item
+		virtual const textdb::keys& keys() const = 0;
+		
+		/// Values of the current item
+		virtual const textdb::values& values() const = 0;
+		
+		/// Checks if the items were not in key order, the source ends at the first such item
+		virtual bool unsorted() const { return false; }
+		
+		/// Checks if the source ended before its last item, valid after the last item
+		virtual bool stopped() const { return unsorted(); }
+		
+};
+
+/// The items of a database
+class map_source : public item_source
+{
+	
+	public:
+		
+		explicit map_source( const textdb::item_map& items ) : _items( items ), _item( items.end() ) {}
+		
+		bool next() override
+		{
+			_item = _started ? std::next( _item ) : _items.begin();
+			_started = true;
+			return _item != _items.end();
+		}
+		
+		const textdb::keys& keys() const override { return _item->first; }
+		const textdb::values& values() const override { return _item->second; }
+		
+	private:
+		
+		const textdb::item_map& _items;
+		textdb::item_map::const_iterator _item;
+		bool _started = false;
+		
+};
+
+/** The items of files in the file format or the tsv format, possibly compressed,
+ * parsed by a thread while they are read. Only a few batches of items are in
+ * memory at once.
+ */
+class file_source : public item_source
+{
+	
+	public:
+		
+		/** The files are read one after the other, as if they were a single file
+		 * \arg tsv the files are in the tsv format
+		 */
+		file_source( const std::vector< std::string >& filenames, bool tsv );
+		~file_source();
+		
+		file_source( const file_source& ) = delete;
+		file_source& operator=( const file_source& ) = delete;
+		
+		bool next() override;
+		const textdb::keys& keys() const override { return _batch[_position].first; }
+		const textdb::values& values() const override { return _batch[_position].second; }
+		bool unsorted() const override { return _unsorted; }
+		bool stopped() const override { return _unsorted || !_error.empty(); }
+		
+		/// Why a file could not be read, empty if there was no error, valid after the last item
+		const std::string& error() const { return _error; }
+		
+	private:
+		
+		/// Number of items per batch
+		static constexpr size_t batch_size = 1024;
+		
+		std::vector< std::string > _filenames;
+		bool _tsv;
+		
+		/// Parsed batches, the parser thread is the producer
+		spsc_queue< textdb::item_batch > _batches{ 4 };
+		
+		/// The batch of the current item
+		textdb::item_batch _batch;
+		size_t _position = 0;
+		
+		std::atomic< bool > _unsorted{ false }, _cancelled{ false };
+		std::string _error;
+		
+		std::thread _thread;
+		
+		/// Thread function
+		void parse();
+		
+};
+
+/** Stream buffer that holds back the first max_size bytes of an output,
+ * e.g. to drop them if the output turns out to be wrong, and passes them
+ * and everything after them on to another stream buffer once there are more
+ */
+class held_output : public std::streambuf
+{
+	
+	public:
+		
+		held_output( std::streambuf* output, size_t max_size ) : _output( output ), _max_size( max_size ) {}
+		
+		/// Has output been passed on
+		bool released() const { return _released; }
+		
+		/// Passes the held output on
+		void release();
+		
+		/// Drops the held output
+		void discard() { std::string().swap( _held ); }
+		
+	protected:
+		
+		int_type overflow( int_type c ) override;
+		std::streamsize xsputn( const char* s, std::streamsize count ) override;
+		int sync() override { return _released ? _output->pubsync() : 0; }
+		
+	private:
+		
+		std::streambuf* _output;
+		size_t _max_size;
+		std::string _held;
+		bool _released = false;
+		
+};
+
+/** Compares two collections in a single pass and prints the differences:
+ * + keys <2 tabs> values   item only in current
+ * - keys <2 tabs> values   item only in old
+ * += keys <2 tabs> values  values only in current of an item in both
+ * -= keys <2 tabs> values  values only in old of an item in both
+ * \returns false if a source is unsorted, the output is incomplete then
+ */
+bool diff_items( item_source& current, item_source& old, char delimiter, std::ostream& output );
+
+/// Changes that merge a collection into another one
+struct merge_result
+{
+	/// Items to add or to set the values of
+	textdb::item_batch assign;
+	
+	/// Items to delete
+	std::vector< textdb::keys > erase;
+	
+	/** Items that were changed in one collection and deleted in the other, or deleted
+	 * in one while the other added subitems to them, they are kept as in ours
+	 */
+	std::vector< textdb::keys > conflicts;
+};
+
+/** Three-way merge in a single pass: finds the changes that apply the changes from
+ * base to theirs to ours. Values added and deleted in theirs are added to and
+ * deleted from the items of ours.
+ * \returns false if a source is unsorted, result is incomplete then
+ */
+bool merge_items( item_source& ours, item_source& theirs, item_source& base, merge_result& result );
+
+#endif
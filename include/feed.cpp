@@ -0,0 +1,398 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+// Member functions for change_feed and change_follower
+
+#include "feed.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+
+namespace
+{
+	/// Fills in the address of a Unix socket, \returns false if the path is too long
+	bool socket_address( const std::string& path, sockaddr_un& address )
+	{
+		std::memset( &address, 0, sizeof(address) );
+		address.sun_family = AF_UNIX;
+		if( path.empty() || path.size() >= sizeof(address.sun_path) )
+			return false;
+		path.copy( address.sun_path, path.size() );
+		return true;
+	}
+	
+	/// Creates a non-blocking Unix stream socket
+	int create_socket()
+	{
+		int fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+		if( fd >= 0 )
+		{
+			fcntl( fd, F_SETFL, fcntl( fd, F_GETFL ) | O_NONBLOCK );
+			fcntl( fd, F_SETFD, FD_CLOEXEC );
+		}
+		return fd;
+	}
+}
+
+bool change_feed::publish( const std::string& path, textdb& db )
+{
+	stop();
+	
+	sockaddr_un address;
+	if( !socket_address( path, address ) )
+		return false;
+	
+	_fd = create_socket();
+	if( _fd < 0 )
+		return false;
+	
+	// a socket file left behind by a process that is gone can be replaced
+	if( ::bind( _fd, (sockaddr*)&address, sizeof(address) ) != 0 )
+	{
+		int probe = socket( AF_UNIX, SOCK_STREAM, 0 );
+		bool used = probe >= 0 && ::connect( probe, (sockaddr*)&address, sizeof(address) ) == 0;
+		if( probe >= 0 )
+			::close( probe );
+		
+		if( used || errno != ECONNREFUSED || ::unlink( path.c_str() ) != 0 || ::bind( _fd, (sockaddr*)&address, sizeof(address) ) != 0 )
+		{
+			::close( _fd );
+			_fd = -1;
+			return false;
+		}
+	}
+	
+	if( ::listen( _fd, 16 ) != 0 || ::pipe( _wake ) != 0 )
+	{
+		::close( _fd );
+		::unlink( path.c_str() );
+		_fd = -1;
+		return false;
+	}
+	fcntl( _wake[0], F_SETFL, fcntl( _wake[0], F_GETFL ) | O_NONBLOCK );
+	fcntl( _wake[1], F_SETFL, fcntl( _wake[1], F_GETFL ) | O_NONBLOCK );
+	
+	_path = path;
+	_db = &db;
+	char delimiter = db.delimiter();
+	db.set_change_listener( [this, delimiter]( textdb::change_type type, const textdb::item_map::value_type* item )
+	{
+		// new followers get all items anyway
+		if( _active > 0 )
+			encode( _changes, type, item, delimiter );
+	});
+	
+	_stopping = false;
+	_thread = std::thread( &change_feed::run, this );
+	return true;
+}
+
+void change_feed::stop()
+{
+	if( _fd < 0 )
+		return;
+	
+	_db->set_change_listener( nullptr );
+	_db = nullptr;
+	
+	{
+		std::lock_guard< std::mutex > lock( _mutex );
+		_stopping = true;
+	}
+	(void)!::write( _wake[1], "", 1 );
+	_thread.join();
+	
+	for( auto& f : _followers )
+		::close( f.fd );
+	for( int fd : _accepted )
+		::close( fd );
+	_followers.clear();
+	_accepted.clear();
+	_active = 0;
+	_changes.clear();
+	
+	::close( _wake[0] );
+	::close( _wake[1] );
+	::close( _fd );
+	::unlink( _path.c_str() );
+	_fd = -1;
+	_path.clear();
+}
+
+void change_feed::update( textdb& db )
+{
+	if( _fd < 0 )
+		return;
+	
+	{
+		std::lock_guard< std::mutex > lock( _mutex );
+		
+		if( _changes.empty() && _accepted.empty() )
+			return;
+		
+		// the changes are sent to the followers known when they were made
+		if( !_changes.empty() )
+		{
+			for( auto& f : _followers )
+				f.pending += _changes;
+			_changes.clear();
+		}
+		
+		// new followers start with all items
+		for( int fd : _accepted )
+		{
+			follower f{ fd, std::string() };
+			encode( f.pending, textdb::change_type::clear, nullptr, db.delimiter() );
+			for( auto& item : db.items() )
+				encode( f.pending, textdb::change_type::set, &item, db.delimiter() );
+			_followers.push_back( std::move( f ) );
+		}
+		_accepted.clear();
+		_active = _followers.size();
+	}
+	(void)!::write( _wake[1], "", 1 );
+}
+
+void change_feed::run()
+{
+	std::vector< pollfd > fds;
+	for( ;; )
+	{
+		fds.assign( { { _wake[0], POLLIN, 0 }, { _fd, POLLIN, 0 } } );
+		{
+			std::lock_guard< std::mutex > lock( _mutex );
+			if( _stopping )
+				return;
+			for( auto& f : _followers )
+				fds.push_back( { f.fd, short( f.pending.empty() ? POLLIN : POLLIN | POLLOUT ), 0 } );
+		}
+		
+		if( ::poll( fds.data(), fds.size(), -1 ) < 0 && errno != EINTR )
+			return;
+		
+		char buffer[256];
+		while( ::read( _wake[0], buffer, sizeof(buffer) ) > 0 );
+		
+		std::lock_guard< std::mutex > lock( _mutex );
+		
+		if( fds[1].revents & POLLIN )
+		{
+			for( int fd; ( fd = ::accept( _fd, nullptr, nullptr ) ) >= 0; )
+			{
+				fcntl( fd, F_SETFL, fcntl( fd, F_GETFL ) | O_NONBLOCK );
+				fcntl( fd, F_SETFD, FD_CLOEXEC );
+				_accepted.push_back( fd );
+			}
+		}
+		
+		// update() only appends to _followers, so the polled followers are still at the same positions
+		for( size_t i = fds.size()-1; i >= 2; i-- )
+		{
+			auto& f = _followers[i-2];
+			bool gone = fds[i].revents & ( POLLERR | POLLHUP | POLLNVAL );
+			
+			// followers don't send anything, a readable socket has been closed
+			if( fds[i].revents & POLLIN )
+				gone = true;
+			
+			if( !gone && ( fds[i].revents & POLLOUT ) )
+			{
+				ssize_t length = ::send( f.fd, f.pending.data(), f.pending.size(), MSG_NOSIGNAL );
+				if( length > 0 )
+					f.pending.erase( 0, length );
+				else if( length < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR )
+					gone = true;
+			}
+			
+			if( gone )
+			{
+				::close( f.fd );
+				_followers.erase( _followers.begin() + (i-2) );
+			}
+		}
+		_active = _followers.size();
+	}
+}
+
+void change_feed::encode( std::string& out, textdb::change_type type, const textdb::item_map::value_type* item, char delimiter )
+{
+	switch( type )
+	{
+		case textdb::change_type::clear:
+			out += "C\n";
+			return;
+		case textdb::change_type::set:
+			out += "S ";
+			break;
+		case textdb::change_type::erase:
+			out += "D ";
+			break;
+	}
+	
+	bool first = true;
+	for( auto& key : item->first )
+	{
+		if( !first )
+			out += delimiter;
+		out += key;
+		first = false;
+	}
+	
+	if( type == textdb::change_type::set && !item->second.empty() )
+	{
+		out += delimiter;
+		for( auto& value : item->second )
+		{
+			out += delimiter;
+			out += value;
+		}
+	}
+	out += '\n';
+}
+
+bool change_follower::follow( const std::string& path )
+{
+	stop();
+	
+	sockaddr_un address;
+	if( !socket_address( path, address ) )
+		return false;
+	
+	_fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+	if( _fd < 0 )
+		return false;
+	
+	if( ::connect( _fd, (sockaddr*)&address, sizeof(address) ) != 0 )
+	{
+		::close( _fd );
+		_fd = -1;
+		return false;
+	}
+	
+	fcntl( _fd, F_SETFD, FD_CLOEXEC );
+	_path = path;
+	_closed = false;
+	_thread = std::thread( &change_follower::run, this );
+	return true;
+}
+
+void change_follower::stop()
+{
+	if( _fd < 0 )
+		return;
+	
+	// wakes up the thread
+	::shutdown( _fd, SHUT_RDWR );
+	_thread.join();
+	
+	::close( _fd );
+	_fd = -1;
+	_path.clear();
+	_received.clear();
+	_partial.clear();
+}
+
+void change_follower::run()
+{
+	char buffer[65536];
+	for( ;; )
+	{
+		ssize_t length = ::read( _fd, buffer, sizeof(buffer) );
+		if( length < 0 && errno == EINTR )
+			continue;
+		
+		std::lock_guard< std::mutex > lock( _mutex );
+		if( length <= 0 )
+		{
+			_closed = true;
+			return;
+		}
+		_received.append( buffer, length );
+	}
+}
+
+bool change_follower::update( textdb& db )
+{
+	if( _fd < 0 )
+		return false;
+	
+	std::string received;
+	bool closed;
+	{
+		std::lock_guard< std::mutex > lock( _mutex );
+		received.swap( _received );
+		closed = _closed;
+	}
+	
+	// apply the complete lines, keep the rest for the next call
+	if( _partial.empty() )
+		_partial.swap( received );
+	else
+		_partial += received;
+	size_t start = 0;
+	for( size_t end; ( end = _partial.find( '\n', start ) ) != std::string::npos; start = end+1 )
+	{
+		std::string line = _partial.substr( start, end - start );
+		apply( line, db );
+	}
+	_partial.erase( 0, start );
+	
+	return !closed;
+}
+
+void change_follower::apply( std::string& line, textdb& db )
+{
+	if( line == "C" )
+	{
+		db.clear();
+		return;
+	}
+	
+	if( line.size() < 2 || line[1] != ' ' )
+		return;
+	
+	std::string key_string = line.substr( 2 ), value_string;
+	size_t split = key_string.find( std::string( 2, db.delimiter() ) );
+	if( split != std::string::npos )
+	{
+		value_string = key_string.substr( split+2 );
+		key_string.erase( split );
+	}
+	
+	textdb::keys item_keys;
+	textdb::string_to_vector( key_string, item_keys, db.delimiter() );
+	
+	if( line[0] == 'S' )
+	{
+		std::vector< std::string > values;
+		textdb::string_to_vector( value_string, values, db.delimiter() );
+		db.assign( item_keys, textdb::values( values.begin(), values.end() ) );
+	}
+	else if( line[0] == 'D' )
+	{
+		auto item = db.find( item_keys );
+		if( item != db.items().end() )
+			db.erase( item );
+	}
+}
@@ -0,0 +1,174 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+// Change feed header
+
+#ifndef TEXTDB_FEED
+#define TEXTDB_FEED
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+#include "textdb.h"
+
+/** Publishes the changes of a database on a Unix socket: every follower gets
+ * all items when it connects and then every change, one line per change:
+ * - S keys <2 delimiters> values  an item has been added or its values changed
+ * - D keys                        an item has been deleted
+ * - C                             all items have been deleted
+ * Changes are collected by the change listener of the database and handed to
+ * a thread that accepts followers and sends to them between commands (see update())
+ */
+class change_feed
+{
+	
+	public:
+		
+		change_feed() {}
+		~change_feed() { stop(); }
+		
+		change_feed( const change_feed& ) = delete;
+		change_feed& operator=( const change_feed& ) = delete;
+		
+		/** Starts publishing the changes of db at the socket path
+		 * \returns false if the socket can't be created or is used by another process
+		 */
+		bool publish( const std::string& path, textdb& db );
+		
+		/// Stops publishing, disconnects all followers and removes the socket
+		void stop();
+		
+		/// Returns the path of the socket, empty if nothing is published
+		const std::string& path() const { return _path; }
+		
+		/** Queues the changes since the last call for the followers and all
+		 * items for the followers that have connected since then
+		 */
+		void update( textdb& db );
+		
+	private:
+		
+		/// A connected follower
+		struct follower
+		{
+			int fd;
+			/// Bytes that haven't been sent yet
+			std::string pending;
+		};
+		
+		std::string _path;
+		
+		/// The listening socket, -1 if nothing is published
+		int _fd = -1;
+		
+		/// Pipe to wake up the thread
+		int _wake[2] = { -1, -1 };
+		
+		/// The published database
+		textdb* _db = nullptr;
+		
+		/// Sends to the followers
+		std::thread _thread;
+		
+		/// Protects _followers, _accepted and _stopping
+		std::mutex _mutex;
+		
+		/// Followers that have got all items
+		std::vector< follower > _followers;
+		
+		/// Followers that are waiting for all items
+		std::vector< int > _accepted;
+		
+		bool _stopping = false;
+		
+		/// Number of _followers, changes are only recorded if there are any
+		std::atomic< size_t > _active{ 0 };
+		
+		/// Encoded changes since the last update
+		std::string _changes;
+		
+		/// Thread function
+		void run();
+		
+		/// Appends a change to out
+		static void encode( std::string& out, textdb::change_type type, const textdb::item_map::value_type* item, char delimiter );
+		
+};
+
+/** Applies the changes published by a change_feed to a replica of its database,
+ * a thread receives the changes so the feed never waits for the follower
+ */
+class change_follower
+{
+	
+	public:
+		
+		change_follower() {}
+		~change_follower() { stop(); }
+		
+		change_follower( const change_follower& ) = delete;
+		change_follower& operator=( const change_follower& ) = delete;
+		
+		/// Connects to the feed at the socket path, \returns false if there is no feed
+		bool follow( const std::string& path );
+		
+		/// Disconnects from the feed
+		void stop();
+		
+		/// Returns the path of the socket, empty if no feed is followed
+		const std::string& path() const { return _path; }
+		
+		/** Applies the changes received since the last call to db, never blocks
+		 * \returns false if the feed has been closed
+		 */
+		bool update( textdb& db );
+		
+	private:
+		
+		std::string _path;
+		
+		/// The connection, -1 if no feed is followed
+		int _fd = -1;
+		
+		/// Receives from the feed
+		std::thread _thread;
+		
+		/// Protects _received and _closed
+		std::mutex _mutex;
+		
+		/// Received bytes that haven't been applied
+		std::string _received;
+		
+		/// Has the feed closed the connection
+		bool _closed = false;
+		
+		/// Incomplete last line of the previous update
+		std::string _partial;
+		
+		/// Thread function
+		void run();
+		
+		/// Applies a single change
+		static void apply( std::string& line, textdb& db );
+		
+};
+
+#endif
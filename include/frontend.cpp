@@ -20,7 +20,96 @@
 
 #include "frontend.h"
 
+/// Results of read only commands
+static query_cache result_cache;
+
+/// Writes saved files in the background
+static background_saver saver;
+
+/// The sharded collection the shards of the database belong to, only dirty shards are saved to it
+static std::string shard_directory;
+
+/// Shard of each file of shard_directory, the shard is clean once the saver has written its file
+static std::map< std::string, size_t > shard_files;
+
+/// Last save of each file other than shards the saver has written, the file watcher doesn't apply them to the database
+static std::map< std::string, background_saver::saved_file > saved_files;
+
+/// Generation and time of the last save of the opened file, for autosave
+static uint64_t saved_generation = 0;
+static std::chrono::steady_clock::time_point saved_time;
+
+/// Held by the session while it runs a command, autosaves of the saver thread only run while it is free
+static std::mutex session_mutex;
+
+/// Messages of autosaves started by the saver thread, printed before the next command
+static std::string autosave_messages;
+
 void process_input( std::string& input, textdb& db, std::map< std::string, std::string >& options, std::ostream& output )
+{
+	if( options["cache"] != "on" || !is_read_only_command( input ) )
+	{
+		process_command( input, db, options, output );
+		return;
+	}
+	
+	// the result also depends on the options
+	std::string query = input;
+	for( auto& o : options )
+		query += '\n' + o.first + '\t' + o.second;
+	
+	// cached result
+	auto cached = result_cache.find( query, db.generation() );
+	if( cached )
+	{
+		output_writer( output ).write( *cached );
+		return;
+	}
+	
+	// write the result as it is produced, keep a copy unless it is too large for the cache
+	uint64_t generation = db.generation();
+	query_cache::recorder recorder( output.rdbuf(), result_cache.max_size() );
+	std::ostream result( &recorder );
+	process_command( input, db, options, result );
+	result.flush();
+	
+	if( result.bad() )
+		output.setstate( std::ios::badbit );
+	else if( recorder.complete() )
+		result_cache.insert( query, generation, std::make_shared< const std::string >( std::move( recorder.result() ) ) );
+}
+
+bool is_read_only_command( const std::string& input )
+{
+	static const std::regex read_only( "(ls|print|search|get|find|count|size|stats|du|export)([[:s:]].*)?" );
+	return std::regex_match( input, read_only );
+}
+
+void process_read_only_inputs( std::vector< std::string >& inputs, textdb& db, const std::map< std::string, std::string >& options, const std::vector< std::ostream* >& outputs, const std::function< void( size_t ) >& done )
+{
+	// the commands don't change the database, each thread takes the next one
+	std::atomic< size_t > next( 0 );
+	auto work = [&]
+	{
+		// options[] is not safe to use from several threads
+		auto thread_options = options;
+		for( size_t i; ( i = next++ ) < inputs.size(); )
+		{
+			process_input( inputs[i], db, thread_options, *outputs[i] );
+			done( i );
+		}
+	};
+	
+	size_t threads = std::min< size_t >( std::max( 1u, std::thread::hardware_concurrency() ), inputs.size() );
+	std::vector< std::thread > helpers;
+	for( size_t t = 1; t < threads; t++ )
+		helpers.emplace_back( work );
+	work();
+	for( auto& helper : helpers )
+		helper.join();
+}
+
+void process_command( std::string& input, textdb& db, std::map< std::string, std::string >& options, std::ostream& output )
 {
 	
 	// help message
@@ -30,13 +119,29 @@ void process_input( std::string& input, textdb& db, std::map< std::string, std::
 	// quit
 	else if( std::regex_match( input, std::regex("(quit|close|exit)") ) )
 	{
+		command_wait_saves( output );
 		exit(0);
 	}
 	
 	// print everything
 	else if( std::regex_match( input, std::regex("(ls|print|search)") ) )
 	{
-		db.print( output, (options["color"] == "on") );
+		db.print( output, (options["color"] == "on"), get_print_options( options, db.delimiter() ) );
+		return;
+	}
+	
+	// list a page of top-level items
+	else if( std::regex_match( input, std::regex("(ls|print|search)[[:s:]]+(after[[:s:]]+.+[[:s:]]+)?limit[[:s:]]+[0-9]{1,9}([[:s:]]+offset[[:s:]]+[0-9]{1,9})?") ) )
+	{
+		// at most 9 digits, limit and offset always fit
+		std::smatch match;
+		std::regex_match( input, match, std::regex("(ls|print|search)[[:s:]]+(after[[:s:]]+(.+)[[:s:]]+)?limit[[:s:]]+([0-9]+)([[:s:]]+offset[[:s:]]+([0-9]+))?") );
+		
+		std::string after = match[3];
+		size_t limit = std::stoul( match[4] );
+		size_t offset = match[6].matched ? std::stoul( match[6] ) : 0;
+		
+		command_list_page( after, offset, limit, db, output, (options["color"] == "on"), get_print_options( options, db.delimiter() ) );
 		return;
 	}
 	
@@ -45,7 +150,7 @@ void process_input( std::string& input, textdb& db, std::map< std::string, std::
 	{
 		std::string term_string = std::regex_replace( input, std::regex("(ls|print|search)[[:s:]]"), "" );
 		
-		command_search_by_key( term_string, db, output, (options["color"] == "on"), (options["regex"] == "on") );
+		command_search_by_key( term_string, db, output, (options["color"] == "on"), (options["regex"] == "on"), get_print_options( options, db.delimiter() ) );
 		return;
 	}
 	
@@ -56,18 +161,26 @@ void process_input( std::string& input, textdb& db, std::map< std::string, std::
 		std::string key_string = std::regex_replace( term_string, std::regex("\t\t.*"), "" ); // keys
 		std::string value_string = std::regex_replace( term_string, std::regex(".*\t\t"), "" ); // values
 		
-		command_search_by_key_value( key_string, value_string, db, output, (options["color"] == "on"), (options["regex"] == "on") );
+		command_search_by_key_value( key_string, value_string, db, output, (options["color"] == "on"), (options["regex"] == "on"), get_print_options( options, db.delimiter() ) );
 		return;
 	}
 	
 	// clear database
 	else if( std::regex_match( input, std::regex("clear") ) )
 	{
-		db.items().clear();
+		db.clear();
 		output << "Deleted everything\n";
 		return;
 	}
 	
+	// rebuild the read optimized layout
+	else if( std::regex_match( input, std::regex("compact") ) )
+	{
+		db.release_shared_values();
+		db.freeze();
+		return;
+	}
+	
 	// count items
 	else if( std::regex_match( input, std::regex("(count|size)") ) )
 	{
@@ -75,6 +188,50 @@ void process_input( std::string& input, textdb& db, std::map< std::string, std::
 		return;
 	}
 	
+	// statistics
+	else if( std::regex_match( input, std::regex("stats") ) )
+	{
+		command_statistics( output, db );
+		return;
+	}
+	
+	// size of subitems
+	else if( std::regex_match( input, std::regex("du([[:s:]].+)?") ) )
+	{
+		std::string key_string = std::regex_replace( input, std::regex("^du[[:s:]]?"), "" );
+		
+		command_disk_usage( key_string, db, output );
+		return;
+	}
+	
+	// list indexes
+	else if( std::regex_match( input, std::regex("index") ) )
+	{
+		for( auto& segment : db.indexes() )
+			output << segment << "\n";
+		return;
+	}
+	
+	// create index
+	else if( std::regex_match( input, std::regex("index[[:s:]].+") ) )
+	{
+		std::string segment = std::regex_replace( input, std::regex("index[[:s:]]"), "" );
+		
+		if( !db.create_index( segment ) )
+			output << "Index " << segment << " exists\n";
+		return;
+	}
+	
+	// delete index
+	else if( std::regex_match( input, std::regex("unindex[[:s:]].+") ) )
+	{
+		std::string segment = std::regex_replace( input, std::regex("unindex[[:s:]]"), "" );
+		
+		if( !db.drop_index( segment ) )
+			output << "No index " << segment << "\n";
+		return;
+	}
+	
 	// list all options
 	else if( std::regex_match( input, std::regex("option") ) )
 	{
@@ -102,6 +259,8 @@ void process_input( std::string& input, textdb& db, std::map< std::string, std::
 		std::string value = std::regex_replace( input, std::regex("option[[:s:]][^[:s:]]+[[:s:]]"), "" );
 		
 		options[option] = value;
+		if( option == "dedup" )
+			db.set_dedup( value == "on" );
 		return;
 	}
 	
@@ -123,6 +282,37 @@ void process_input( std::string& input, textdb& db, std::map< std::string, std::
 		return;
 	}
 	
+	// import file
+	else if( std::regex_match( input, std::regex("import[[:s:]].+") ) )
+	{
+		std::string filename = std::regex_replace( input, std::regex("import[[:s:]]"), "" );
+		bool replace = std::regex_match( filename, std::regex(".+[[:s:]]replace") );
+		filename = std::regex_replace( filename, std::regex("[[:s:]](merge|replace)$"), "" );
+		
+		command_import_file( filename, db, output, replace );
+		return;
+	}
+	
+	// compare with a file
+	else if( std::regex_match( input, std::regex("diff[[:s:]].+") ) )
+	{
+		std::string filename = std::regex_replace( input, std::regex("diff[[:s:]]"), "" );
+		
+		command_diff_file( filename, db, output );
+		return;
+	}
+	
+	// three-way merge
+	else if( std::regex_match( input, std::regex("merge[[:s:]].+\t\t.+") ) )
+	{
+		std::smatch match;
+		std::regex_match( input, match, std::regex("merge[[:s:]](.+)\t\t(.+)") );
+		std::string filename = match[1], base = match[2];
+		
+		command_merge_file( filename, base, db, output );
+		return;
+	}
+	
 	// save to currently opened file
 	else if( std::regex_match( input, std::regex("save") ) )
 	{
@@ -143,6 +333,24 @@ void process_input( std::string& input, textdb& db, std::map< std::string, std::
 		return;
 	}
 	
+	// wait for background saves
+	else if( std::regex_match( input, std::regex("wait") ) )
+	{
+		command_wait_saves( output );
+		return;
+	}
+	
+	// background saves
+	else if( std::regex_match( input, std::regex("status") ) )
+	{
+		auto pending = saver.pending();
+		if( pending.empty() )
+			output << "No pending saves\n";
+		for( auto& filename : pending )
+			output << "Saving " << filename << "\n";
+		return;
+	}
+	
 	// add values
 	else if( std::regex_match( input, std::regex("(add-value|touch)[[:s:]].+\t\t.+") ) )
 	{
@@ -164,7 +372,7 @@ void process_input( std::string& input, textdb& db, std::map< std::string, std::
 		
 		while( new_keys.size() >= 1 )
 		{
-			db.items().try_emplace( new_keys, textdb::values() );
+			db.add( new_keys );
 			new_keys.pop_back();
 		}
 		return;
@@ -233,6 +441,24 @@ void process_input( std::string& input, textdb& db, std::map< std::string, std::
 		return;
 	}
 	
+	// find items by key elements
+	else if( std::regex_match( input, std::regex("find[[:s:]]([^\t]+\t?)+(\t\t[0-9]{1,9})?") ) )
+	{
+		// at most 9 digits, the depth always fits
+		std::string key_string = std::regex_replace( input, std::regex("find[[:s:]]"), "" );
+		
+		size_t depth = 0;
+		size_t split = key_string.find( "\t\t" );
+		if( split != std::string::npos )
+		{
+			depth = std::stoul( key_string.substr( split+2 ) );
+			key_string.erase( split );
+		}
+		
+		command_find( key_string, depth, db, output );
+		return;
+	}
+	
 	// export to tsv
 	else if( std::regex_match( input, std::regex("export[[:s:]]+tsv") ) )
 	{
@@ -241,19 +467,50 @@ void process_input( std::string& input, textdb& db, std::map< std::string, std::
 	}
 	
 	// export to graphviz
-	/* TODO! Disabled for now, key elements with the same name are not handled
-	else if( std::regex_match( input, std::regex("export[[:s:]]+gv") ) )
+	else if( std::regex_match( input, std::regex("export[[:s:]]+gv([[:s:]]+[0-9]{1,9}){0,2}") ) )
 	{
-		db.to_graphviz( std::cout );
+		// at most 9 digits, the limits always fit
+		std::smatch match;
+		std::regex_match( input, match, std::regex("export[[:s:]]+gv([[:s:]]+([0-9]+))?([[:s:]]+([0-9]+))?") );
+		
+		size_t max_depth = match[2].matched ? std::stoul( match[2] ) : 0;
+		size_t max_children = match[4].matched ? std::stoul( match[4] ) : 0;
+		
+		db.to_graphviz( output, max_depth, max_children );
 		return;
 	}
-	*/
 	
 	else
 		output << "Unknown command or invalid arguments, type help for a list of available commands\n";
 	
 }
 
+textdb::print_options get_print_options( std::map< std::string, std::string >& options, char delimiter )
+{
+	textdb::print_options projection;
+	
+	try
+	{
+		projection.max_depth = std::stoul( options["depth"] );
+	}
+	catch( std::exception& e )
+	{
+		projection.max_depth = 0;
+	}
+	
+	if( options["fields"] != "*" )
+	{
+		std::string fields = options["fields"];
+		std::replace( fields.begin(), fields.end(), ',', delimiter );
+		
+		std::vector< std::string > field_terms({});
+		textdb::string_to_vector( fields, field_terms, delimiter );
+		projection.fields.insert( field_terms.begin(), field_terms.end() );
+	}
+	
+	return projection;
+}
+
 void command_help( std::ostream& output )
 {
 
@@ -270,23 +527,107 @@ open|load
 open|load [file]
 save
 save [file]
+wait
+status
+import [file] [merge|replace]
+diff [file]
+merge [file] [base file]
 ls|print|search
 ls|print|search [keys]
 ls|print|search [keys] [values]
+ls|print|search limit [n] [offset [n]]
+ls|print|search after [key] limit [n]
 count|size
+stats
+du [keys]
+index
+index [key]
+unindex [key]
 add-value [keys] [values]
 add-item|add-key|mkdir [keys]
 add-item|add-key|mkdir [keys] [subkeys]
 rm|delete [keys]
 rm|delete [keys] [values]
 clear
+compact
 mv|rename [source keys] [dest keys]
 cp [source keys] [dest keys]
 get [keys]
+find [keys]
+find [keys] [depth]
+export tsv
+export gv [max depth] [max subitems]
 option
 option [option]
 option [option] [value]
 
+Options:
+color on|off   colored output
+regex on|off   treat search terms as regex
+watch on|off   apply changes made to the opened file by other programs
+cache on|off   keep the results of read only commands until the next change
+dedup on|off   items with equal values share them, saves memory
+publish [path] publish all changes on the Unix socket [path], off for none
+follow [path]  apply the changes published on the Unix socket [path], off for none
+autosave [n]   save the opened file every [n] seconds if it has changed, 0 for off
+depth [n]      ls prints only [n] levels of each item, 0 for all levels
+fields [keys]  ls prints only these comma separated subitems, * for all
+
+import merges the items of a file into the database, values are added to
+existing items. With replace the top-level items of the file replace the
+existing items.
+
+diff compares the database with a file in a single pass over both and
+prints the items only in the database (+), only in the file (-) and the
+values added (+=) and deleted (-=) in the database. merge applies the
+changes made in [file] since [base file] to the database, items changed
+in one and deleted in the other are kept as they are in the database, as
+are items deleted in one that the other added subitems to. Files that are
+not sorted like saved files are loaded first, diff stops at the first item
+out of order instead once it has printed more than 1 MB.
+
+ls with limit prints [n] top-level items, skipping the first [offset] items
+or starting after the top-level item [key]. These forms are taken before a
+search for keys that read the same, search for such a key with a regex,
+e.g. ls limi[t] 5
+
+du prints the size in bytes, the number of items and values for each
+subitem of [keys] (the top-level items without [keys]). Only the counts of
+top-level items are kept up to date: du without [keys] takes constant time
+per item, du [keys] goes through the subitems of [keys].
+
+ls with [values] finds the items that have a value matching each of [values].
+Values are compared as numbers or dates (YYYY-MM-DD [HH:MM[:SS]]) by value
+search terms >[x], >=[x], <[x], <=[x] and [x]..[y] (inclusive), e.g.
+ls .*  <1 tab>  width  <2 tabs>  >4000
+index [key] keeps the numbers and dates of all items whose last key is [key]
+sorted, searches with a literal last key and a single such term use it.
+
+find prints the path and values of all items whose last key is the last of
+[keys] and whose path contains the other [keys] in this order, optionally
+only items with [depth] keys. [keys] are compared as strings.
+
+save takes a snapshot of the database and writes it in the background, wait
+blocks until all saves are finished, status lists the files that are being
+saved. The snapshot is a copy of all items in the read optimized layout, it
+is taken before save returns and takes time proportional to the size of the
+database if the database has changed since the last one. The layout is only
+built for snapshots and by compact, until then the items are only kept once.
+
+A directory is a sharded collection: one file per range of top-level keys
+and a manifest. Shards are loaded in parallel, save only writes the shards
+that have changed, e.g. save items/
+
+Files with the extension .tsv are loaded, imported and saved in the format
+of export tsv. Files with the extension .gz (or .zst) are saved compressed,
+compressed files are detected and decompressed when they are loaded, e.g.
+save items.tsv.gz
+
+A process with option publish sends all items to every process that
+follows it and then every change, between commands. Followers apply the
+changes before each command and keep their own changes until the next
+load or clear of the publisher, e.g. option publish /tmp/items.sock
+
 Use a single tab to separate fields in an argument, use two tabs to
 separate between arguments, e.g.:
 key1  <1 tab>  key2  <2 tabs>  value1  <1 tab>  value2
@@ -298,20 +639,75 @@ Licensed under the GNU GPL v3 or later
 
 void command_count( std::ostream& output, textdb& db )
 {
-	// count top-level items
-	size_t top_items = 0;
-	for( auto& item : db.items() )
+	// the counters are kept up to date by textdb
+	output << "Number of items (excluding subitems): " << db.top_level_items() << "\n";
+	output << "Number of items (including subitems): " << db.total().items << "\n";
+	return;
+}
+
+void command_statistics( std::ostream& output, textdb& db )
+{
+	command_count( output, db );
+	output << "Number of values: " << db.total().values << "\n";
+	output << "Size in bytes: " << db.total().bytes << "\n";
+}
+
+void command_disk_usage( std::string& keys, textdb& db, std::ostream& output )
+{
+	try
 	{
-		if( item.first.size() == 1 )
-			top_items++;
+		textdb::keys parent({});
+		textdb::string_to_vector( keys, parent, db.delimiter() );
+		
+		// iterate over the direct subitems of parent, skip their subitems
+		auto range = db.subtree( parent );
+		if( !parent.empty() && range.first != range.second && range.first->first == parent )
+			range.first++;
+		
+		for( auto item = range.first; item != range.second; )
+		{
+			if( item->first.size() != parent.size()+1 )
+			{
+				item++;
+				continue;
+			}
+			
+			textdb::statistics s = db.subtree_statistics( *item );
+			output << s.bytes << "\t" << s.items << "\t" << s.values << "\t" << item->first.back() << "\n";
+			
+			item = db.subtree( item->first ).second;
+		}
+	}
+	catch( std::exception& e )
+	{
+		output << e.what() << "\n";
+		return;
 	}
+}
+
+void command_list_page( std::string& after, size_t offset, size_t limit, textdb& db, std::ostream& output, bool use_color, const textdb::print_options& projection )
+{
+	// first top-level item after the cursor
+	auto item = after.empty() ? db.items().begin() : db.subtree( textdb::keys({after}) ).second;
 	
-	output << "Number of items (excluding subitems): " << top_items << "\n";
-	output << "Number of items (including subitems): " << db.items().size() << "\n";
-	return;
+	// the items between top-level items are skipped with one search per top-level item
+	for( size_t count = 0; item != db.items().end() && count < offset + limit; )
+	{
+		if( item->first.size() != 1 )
+		{
+			item++;
+			continue;
+		}
+		
+		if( count >= offset )
+			db.print( output, use_color, item->first, projection );
+		
+		count++;
+		item = db.subtree( item->first ).second;
+	}
 }
 
-void command_search_by_key( std::string& keys, textdb& db, std::ostream& output, bool use_color, bool use_regex )
+void command_search_by_key( std::string& keys, textdb& db, std::ostream& output, bool use_color, bool use_regex, const textdb::print_options& projection )
 {
 	try
 	{
@@ -323,15 +719,12 @@ void command_search_by_key( std::string& keys, textdb& db, std::ostream& output,
 		std::set< std::string > results;
 		
 		// perform search
-		for( auto& item : db.items() )
-		{
-			if( use_regex ? textdb::compare_vectors_regex_exact( item.first, terms ) : textdb::compare_vectors_exact( item.first, terms ) )
-				results.emplace( item.first.front() );
-		}
+		query_plan plan( db, terms, {}, use_regex, true );
+		plan.for_each( [&results]( textdb::item_map::const_iterator item ){ results.emplace( item->first.front() ); } );
 		
 		// print results
 		for( auto& r : results )
-			db.print( output, use_color, textdb::keys({r}) );
+			db.print( output, use_color, textdb::keys({r}), projection );
 		
 	}
 	catch( std::exception& e )
@@ -341,7 +734,7 @@ void command_search_by_key( std::string& keys, textdb& db, std::ostream& output,
 	}
 }
 
-void command_search_by_key_value( std::string& keys, std::string& values, textdb& db, std::ostream& output, bool use_color, bool use_regex )
+void command_search_by_key_value( std::string& keys, std::string& values, textdb& db, std::ostream& output, bool use_color, bool use_regex, const textdb::print_options& projection )
 {
 	try
 	{
@@ -353,46 +746,90 @@ void command_search_by_key_value( std::string& keys, std::string& values, textdb
 		// holds the first element of the result keys
 		std::set< std::string > results;
 		
-		// perform search
-		for( auto& item : db.items() )
+		// perform search, typed terms compare numbers and dates
+		query_plan plan( db, key_terms, value_terms, use_regex, true );
+		plan.for_each( [&results]( textdb::item_map::const_iterator item ){ results.emplace( item->first.front() ); } );
+		
+		// print results
+		for( auto& r : results )
+			db.print( output, use_color, textdb::keys({r}), projection );
+		
+	}
+	catch( std::exception& e )
+	{
+		output << e.what() << "\n";
+		return;
+	}
+}
+
+void command_find( std::string& keys, size_t depth, textdb& db, std::ostream& output )
+{
+	try
+	{
+		// search terms
+		std::vector< std::string > terms({});
+		textdb::string_to_vector( keys, terms, db.delimiter() );
+		if( terms.empty() )
+			return;
+		
+		// the item has the last term as key, its parents contain the other terms in order
+		auto matches = [&terms, depth]( const textdb::keys& path )
 		{
+			if( path.back() != terms.back() || ( depth > 0 && path.size() != depth ) )
+				return false;
 			
-			// search by key
-			if( use_regex ? textdb::compare_vectors_regex_exact( item.first, key_terms ) : textdb::compare_vectors_exact( item.first, key_terms ) )
+			size_t t = 0;
+			for( size_t i = 0; i+1 < path.size() && t+1 < terms.size(); i++ )
 			{
-				
-				// check values
-				bool values_match = false;
-				
-				// iterate over value search terms
-				for( auto value_term : value_terms )
-				{
-					// iterate over item values
-					for( auto value : item.second )
-					{
-						// check value
-						if( use_regex ? std::regex_match( value, std::regex(value_term) ) : (value == value_term) )
-						{
-							values_match = true;
-							break;
-						}
-					}
-					
-					if( !values_match )
-						break;
-					
-				}
-				
-				// store result
-				if( values_match )
-					results.emplace( item.first.front() );
+				if( path[i] == terms[t] )
+					t++;
+			}
+			return t+1 == terms.size();
+		};
+		
+		// start with the shortest posting list
+		size_t rarest = terms.size()-1;
+		for( size_t i = 0; i < terms.size(); i++ )
+		{
+			if( db.postings( terms[i] ).size() < db.postings( terms[rarest] ).size() )
+				rarest = i;
+		}
+		
+		std::vector< const textdb::item_map::value_type* > results;
+		for( auto item : db.postings( terms[rarest] ) )
+		{
+			if( rarest == terms.size()-1 )
+			{
+				if( matches( item->first ) )
+					results.push_back( item );
+				continue;
+			}
+			
+			// items with other terms are parents of the results
+			auto range = db.subtree( item->first );
+			for( auto subitem = std::next( range.first ); subitem != range.second; subitem++ )
+			{
+				if( matches( subitem->first ) )
+					results.push_back( &*subitem );
 			}
 		}
 		
-		// print results
-		for( auto& r : results )
-			db.print( output, use_color, textdb::keys({r}) );
+		// a result can be found through several parents
+		std::sort( results.begin(), results.end(), []( auto a, auto b ){ return a->first < b->first; } );
+		results.erase( std::unique( results.begin(), results.end() ), results.end() );
 		
+		// print path and values
+		for( auto item : results )
+		{
+			for( size_t i = 0; i < item->first.size(); i++ )
+				output << ( i > 0 ? "\t" : "" ) << item->first[i];
+			
+			if( !item->second.empty() )
+				output << "\t";
+			for( auto& value : item->second )
+				output << "\t" << value;
+			output << "\n";
+		}
 	}
 	catch( std::exception& e )
 	{
@@ -401,25 +838,409 @@ void command_search_by_key_value( std::string& keys, std::string& values, textdb
 	}
 }
 
+/// Returns the path of a sharded collection without trailing slashes
+static std::string collection_directory( std::string directory )
+{
+	while( directory.size() > 1 && directory.back() == '/' )
+		directory.pop_back();
+	
+	return directory;
+}
+
 void command_load_file( std::string& filename, textdb& db, std::map< std::string, std::string >& options, std::ostream& output )
 {
-	std::ifstream infile( filename );
+	// the file might be being saved
+	saver.wait();
+	shard_files.clear();
+	
+	if( shard_manifest::is_sharded( filename ) )
+	{
+		std::string error = load_shards( filename, db );
+		if( !error.empty() )
+		{
+			output << error << "\n";
+			return;
+		}
+		
+		// sh/ and sh are the same collection
+		options["file"] = collection_directory( filename );
+		shard_directory = options["file"];
+		
+		saved_generation = db.generation();
+		saved_time = std::chrono::steady_clock::now();
+		return;
+	}
+	
+	input_file infile( filename );
 	
 	if( !infile.is_open() )
 	{
-		output << "Could not open " << filename << "\n";
+		output << ( infile.error().empty() ? "Could not open " + filename : infile.error() ) << "\n";
 		return;
 	}
 	
 	options["file"] = filename;
-	db.items().clear();
-	db.load( infile );
+	db.clear();
+	db.set_shards( {} );
+	if( is_tsv_file( filename ) )
+		db.load_tsv( infile );
+	else
+		db.load( infile );
 	infile.close();
+	
+	if( !infile.error().empty() )
+		output << infile.error() << "\n";
+	
+	saved_generation = db.generation();
+	saved_time = std::chrono::steady_clock::now();
+}
+
+bool is_tsv_file( const std::string& filename )
+{
+	std::string name = strip_compression_extension( filename );
+	return name.size() > 4 && name.compare( name.size()-4, 4, ".tsv" ) == 0;
+}
+
+void command_import_file( std::string& filename, textdb& db, std::ostream& output, bool replace )
+{
+	saver.wait();
+	
+	input_file infile( filename );
+	
+	if( !infile.is_open() )
+	{
+		output << ( infile.error().empty() ? "Could not open " + filename : infile.error() ) << "\n";
+		return;
+	}
+	
+	// read all items, then merge them in one pass
+	textdb::item_batch batch;
+	auto add_item = [&batch]( const textdb::keys& item_keys, textdb::values& item_values )
+	{
+		batch.emplace_back( item_keys, std::move( item_values ) );
+	};
+	
+	// missing tsv parents go last, the first of duplicate items is kept by merge
+	textdb::item_batch parents;
+	auto add_parent = [&parents]( const textdb::keys& parent_keys )
+	{
+		parents.emplace_back( parent_keys, textdb::values() );
+	};
+	
+	textdb::keys temp_keys({""});
+	if( is_tsv_file( filename ) )
+		db.parse_tsv( infile, add_item, add_parent );
+	else
+		db.parse( infile, temp_keys, add_item );
+	infile.close();
+	
+	if( !infile.error().empty() )
+		output << infile.error() << "\n";
+	
+	std::move( parents.begin(), parents.end(), std::back_inserter( batch ) );
+	db.merge( batch, replace );
+}
+
+/// Opens the items of a file or a sharded collection in key order, nullptr if it can't be opened
+static std::unique_ptr< file_source > open_source( const std::string& filename, std::ostream& output )
+{
+	std::vector< std::string > files;
+	if( shard_manifest::is_sharded( filename ) )
+	{
+		shard_manifest manifest;
+		if( !manifest.read( filename ) )
+		{
+			output << "Could not read the manifest of " << filename << "\n";
+			return nullptr;
+		}
+		for( size_t i = 0; i < manifest.files.size(); i++ )
+			files.push_back( manifest.path( filename, i ) );
+		return std::make_unique< file_source >( files, false );
+	}
+	
+	if( !std::ifstream( filename ) )
+	{
+		output << "Could not open " << filename << "\n";
+		return nullptr;
+	}
+	return std::make_unique< file_source >( std::vector< std::string >({ filename }), is_tsv_file( filename ) );
+}
+
+/// Loads a file or a sharded collection into an empty database, \returns an error message, empty on success
+static std::string load_collection( const std::string& filename, textdb& db )
+{
+	if( shard_manifest::is_sharded( filename ) )
+		return load_shards( filename, db );
+	
+	input_file infile( filename );
+	if( !infile.is_open() )
+		return infile.error().empty() ? "Could not open " + filename : infile.error();
+	
+	if( is_tsv_file( filename ) )
+		db.load_tsv( infile );
+	else
+		db.load( infile );
+	infile.close();
+	return infile.error();
+}
+
+void command_diff_file( std::string& filename, textdb& db, std::ostream& output )
+{
+	try
+	{
+		// the start of the differences is held back in case the file can't be compared in a single pass
+		held_output held( output.rdbuf(), 1 << 20 );
+		{
+			auto old = open_source( filename, output );
+			if( !old )
+				return;
+			
+			std::ostream result( &held );
+			map_source current( db.items() );
+			bool sorted = diff_items( current, *old, db.delimiter(), result );
+			result.flush();
+			if( !old->error().empty() )
+			{
+				output << old->error() << "\n";
+				if( held.released() )
+					output << "The differences above are incomplete\n";
+				return;
+			}
+			
+			if( sorted || held.released() )
+			{
+				held.release();
+				if( !sorted )
+					output << filename << " is not in key order, the differences above are incomplete\n";
+				return;
+			}
+		}
+		
+		// not in key order, compare with a loaded copy
+		held.discard();
+		textdb old_db;
+		std::string error = load_collection( filename, old_db );
+		if( !error.empty() )
+		{
+			output << error << "\n";
+			return;
+		}
+		
+		map_source current( db.items() ), old( old_db.items() );
+		diff_items( current, old, db.delimiter(), output );
+	}
+	catch( std::exception& e )
+	{
+		output << e.what() << "\n";
+		return;
+	}
+}
+
+void command_merge_file( std::string& filename, std::string& base, textdb& db, std::ostream& output )
+{
+	try
+	{
+		merge_result result;
+		bool sorted;
+		{
+			auto theirs = open_source( filename, output );
+			auto base_items = theirs ? open_source( base, output ) : nullptr;
+			if( !theirs || !base_items )
+				return;
+			
+			map_source ours( db.items() );
+			sorted = merge_items( ours, *theirs, *base_items, result );
+			for( auto source : { theirs.get(), base_items.get() } )
+			{
+				if( !source->error().empty() )
+				{
+					output << source->error() << "\n";
+					return;
+				}
+			}
+		}
+		
+		// not in key order, merge loaded copies
+		if( !sorted )
+		{
+			textdb their_db, base_db;
+			for( auto& load : { std::make_pair( &filename, &their_db ), std::make_pair( &base, &base_db ) } )
+			{
+				std::string error = load_collection( *load.first, *load.second );
+				if( !error.empty() )
+				{
+					output << error << "\n";
+					return;
+				}
+			}
+			
+			map_source ours( db.items() ), theirs( their_db.items() ), base_items( base_db.items() );
+			result = merge_result();
+			merge_items( ours, theirs, base_items, result );
+		}
+		
+		// apply the changes after reading, the items of the database were read in place
+		for( auto& keys : result.erase )
+		{
+			auto item = db.items().find( keys );
+			if( item != db.items().end() )
+				db.erase( item );
+		}
+		for( auto& item : result.assign )
+			db.assign( item.first, item.second );
+		
+		for( auto& keys : result.conflicts )
+		{
+			output << "Conflict, kept";
+			for( size_t i = 0; i < keys.size(); i++ )
+				output << ( i ? db.delimiter() : ' ' ) << keys[i];
+			output << "\n";
+		}
+	}
+	catch( std::exception& e )
+	{
+		output << e.what() << "\n";
+		return;
+	}
+}
+
+/** Marks the shards whose files the saver has written as unchanged,
+ * other written files are kept in saved_files
+ */
+static void mark_saved_shards( textdb& db )
+{
+	for( auto& file : saver.saved() )
+	{
+		auto shard = shard_files.find( file.filename );
+		if( shard != shard_files.end() )
+			db.mark_clean( shard->second, file.tag );
+		else
+			saved_files[file.filename] = file;
+	}
+}
+
+void command_sync_file( file_watcher& watcher, textdb& db, std::map< std::string, std::string >& options, std::ostream& output )
+{
+	// watching is disabled or no file is opened
+	if( options["watch"] != "on" || options.find( "file" ) == options.end() )
+	{
+		if( !watcher.filename().empty() )
+			watcher.stop();
+		saved_files.clear();
+		return;
+	}
+	
+	// a different file has been opened
+	if( watcher.filename() != options["file"] )
+	{
+		saved_files.clear();
+		
+		if( is_tsv_file( options["file"] ) || detect_compression( options["file"] ) != compression::none || shard_manifest::is_sharded( options["file"] ) )
+		{
+			output << "Watching is not supported for tsv, compressed and sharded files\n";
+			options["watch"] = "off";
+			return;
+		}
+		
+		if( !watcher.watch( options["file"], db.delimiter() ) )
+		{
+			output << "Could not watch " << options["file"] << "\n";
+			options["watch"] = "off";
+		}
+		return;
+	}
+	
+	// the saver replaces the file, its changes are looked at when it is done
+	auto pending = saver.pending();
+	if( std::find( pending.begin(), pending.end(), watcher.filename() ) != pending.end() )
+		return;
+	
+	// the session's own saves hold the database already, only later changes are applied
+	mark_saved_shards( db );
+	auto saved = saved_files.find( watcher.filename() );
+	if( saved != saved_files.end() )
+	{
+		file_watcher::file_state written;
+		written.device = saved->second.device;
+		written.inode = saved->second.inode;
+		written.mtime = saved->second.mtime;
+		written.size = saved->second.size;
+		saved_files.clear();
+		
+		if( !watcher.saved( db, written ) )
+		{
+			output << "Could not watch " << options["file"] << "\n";
+			options["watch"] = "off";
+		}
+		return;
+	}
+	
+	saved_files.clear();
+	watcher.update( db );
+}
+
+void command_replicate( change_feed& feed, change_follower& follower, textdb& db, std::map< std::string, std::string >& options, std::ostream& output )
+{
+	const std::string& publish = options["publish"];
+	if( publish == "off" )
+	{
+		if( !feed.path().empty() )
+			feed.stop();
+	}
+	else if( feed.path() != publish )
+	{
+		if( !feed.publish( publish, db ) )
+		{
+			output << "Could not publish at " << publish << "\n";
+			options["publish"] = "off";
+		}
+	}
+	else
+		feed.update( db );
+	
+	const std::string& follow = options["follow"];
+	if( follow == "off" )
+	{
+		if( !follower.path().empty() )
+			follower.stop();
+	}
+	else if( follower.path() != follow )
+	{
+		if( !follower.follow( follow ) )
+		{
+			output << "Could not follow " << follow << "\n";
+			options["follow"] = "off";
+		}
+	}
+	else if( !follower.update( db ) )
+	{
+		output << "The feed at " << follow << " has been closed\n";
+		follower.stop();
+		options["follow"] = "off";
+	}
 }
 
 void command_save_file( std::string& filename, textdb& db, std::ostream& output )
 {
-	std::ofstream outfile( filename );
+	if( !compression_supported( compression_for_name( filename ) ) )
+	{
+		output << "The compression of " << filename << " is not supported by this build\n";
+		return;
+	}
+	
+	std::error_code error;
+	if( std::filesystem::is_directory( filename, error ) || ( !filename.empty() && filename.back() == '/' ) )
+	{
+		command_save_shards( filename, db, output );
+		return;
+	}
+	
+	if( saver.save( db, filename, is_tsv_file( filename ) ) )
+		return;
+	
+	// no snapshot possible, save now after the pending saves
+	saver.wait();
+	output_file outfile( filename, compression_for_name( filename ) );
 	
 	if( !outfile.is_open() )
 	{
@@ -427,8 +1248,184 @@ void command_save_file( std::string& filename, textdb& db, std::ostream& output
 		return;
 	}
 	
-	db.print( outfile, false );
-	outfile.close();
+	if( is_tsv_file( filename ) )
+		db.to_tsv( outfile );
+	else
+		db.print( outfile, false );
+	
+	if( !outfile.close() )
+		output << "Could not write " << filename << "\n";
+}
+
+/// Checks if saving to a file only queues background saves, without waiting for the saver or writing synchronously
+static bool saves_in_background( const std::string& filename, textdb& db )
+{
+	std::error_code error;
+	if( std::filesystem::is_directory( filename, error ) || ( !filename.empty() && filename.back() == '/' ) )
+	{
+		// a new layout is written while the saver is waited for
+		shard_manifest manifest;
+		if( !( collection_directory( filename ) == shard_directory && manifest.read( shard_directory ) && manifest.first_keys == db.shards() ) )
+			return false;
+	}
+	
+	return compression_supported( compression_for_name( filename ) ) && db.snapshot() != nullptr;
+}
+
+void command_save_shards( std::string directory, textdb& db, std::ostream& output )
+{
+	directory = collection_directory( directory );
+	
+	std::error_code error;
+	std::filesystem::create_directories( directory, error );
+	if( !std::filesystem::is_directory( directory, error ) )
+	{
+		output << "Could not create " << directory << "\n";
+		return;
+	}
+	
+	// save only the dirty shards if the collection has the layout of the database
+	mark_saved_shards( db );
+	shard_manifest manifest, old_manifest;
+	bool relayout = !( directory == shard_directory && manifest.read( directory ) && manifest.first_keys == db.shards() );
+	if( relayout )
+	{
+		// the old files stay intact until the new manifest replaces the old one
+		old_manifest.read( directory );
+		manifest = shard_manifest::split( db, shard_manifest::default_shard_size, old_manifest.files );
+		db.set_shards( manifest.first_keys );
+	}
+	
+	shard_files.clear();
+	for( size_t i = 0; i < manifest.files.size(); i++ )
+		shard_files[manifest.path( directory, i )] = i;
+	shard_directory = directory;
+	
+	auto items = db.snapshot();
+	uint64_t generation = db.generation();
+	for( size_t i : db.dirty_shards() )
+	{
+		// the shard holds the items from its first key up to the first key of the next shard
+		textdb::keys first({ manifest.first_keys[i] }), last;
+		if( i+1 < manifest.first_keys.size() )
+			last = textdb::keys({ manifest.first_keys[i+1] });
+		
+		std::string path = manifest.path( directory, i );
+		if( items )
+		{
+			saver.save( items, db.delimiter(), path, items->lower_bound( first ), last.empty() ? items->size() : items->lower_bound( last ), generation );
+			continue;
+		}
+		
+		// no snapshot possible, save now
+		saver.wait();
+		output_file outfile( path, compression::none );
+		db.print( outfile, db.items().lower_bound( first ), last.empty() ? db.items().end() : db.items().lower_bound( last ) );
+		if( outfile.close() )
+			db.mark_clean( i, generation );
+		else
+			output << "Could not write " << path << "\n";
+	}
+	
+	if( !relayout )
+		return;
+	
+	// the new manifest is written when all shards are, the old one stays if any failed
+	saver.wait();
+	mark_saved_shards( db );
+	if( !db.dirty_shards().empty() )
+	{
+		output << "Could not write the shards of " << directory << "\n";
+		for( auto& file : manifest.files )
+			std::filesystem::remove( directory + "/" + file, error );
+		
+		return;
+	}
+	
+	if( !manifest.write( directory ) )
+	{
+		output << "Could not write the manifest of " << directory << "\n";
+		return;
+	}
+	
+	for( auto& file : old_manifest.files )
+	{
+		if( std::find( manifest.files.begin(), manifest.files.end(), file ) == manifest.files.end() )
+			std::filesystem::remove( directory + "/" + file, error );
+	}
+}
+
+void command_wait_saves( std::ostream& output )
+{
+	saver.wait();
+	for( auto& error : saver.errors() )
+		output << error << "\n";
+}
+
+std::unique_lock< std::mutex > lock_session()
+{
+	return std::unique_lock< std::mutex >( session_mutex );
+}
+
+/** Saves the opened file if it has changed and the autosave interval has passed,
+ * only if the save can be left to the saver thread if background is true
+ */
+static void autosave( textdb& db, std::map< std::string, std::string >& options, std::ostream& output, bool background )
+{
+	auto now = std::chrono::steady_clock::now();
+	if( saved_generation == 0 )
+	{
+		// the loaded state doesn't need to be saved
+		saved_generation = db.generation();
+		saved_time = now;
+	}
+	
+	int interval = std::atoi( options["autosave"].c_str() );
+	if( interval <= 0 || options.find( "file" ) == options.end() || db.generation() == saved_generation )
+		return;
+	
+	if( now - saved_time < std::chrono::seconds( interval ) )
+		return;
+	
+	// the saver thread can't wait for itself, the session saves before its next command then
+	if( background && !saves_in_background( options["file"], db ) )
+		return;
+	
+	saved_generation = db.generation();
+	saved_time = now;
+	command_save_file( options["file"], db, output );
+}
+
+void command_background_save( textdb& db, std::map< std::string, std::string >& options, std::ostream& output )
+{
+	for( auto& error : saver.errors() )
+		output << error << "\n";
+	
+	mark_saved_shards( db );
+	
+	output << autosave_messages;
+	autosave_messages.clear();
+	
+	autosave( db, options, output, false );
+	
+	// idle sessions are saved by the saver thread, a busy session saves before its next command
+	int interval = std::atoi( options["autosave"].c_str() );
+	bool opened = options.find( "file" ) != options.end();
+	saver.set_timer( std::chrono::seconds( ( interval > 0 && opened ) ? interval : 0 ), [&db, &options]
+	{
+		std::unique_lock< std::mutex > lock( session_mutex, std::try_to_lock );
+		if( !lock.owns_lock() )
+			return;
+		
+		std::ostringstream messages;
+		autosave( db, options, messages, true );
+		autosave_messages += messages.str();
+	} );
+}
+
+void command_stop_autosave()
+{
+	saver.set_timer( std::chrono::seconds( 0 ), nullptr );
 }
 
 void command_add_values( std::string& key_string, std::string& value_string, textdb& db, std::ostream& output, bool use_regex )
@@ -440,19 +1437,14 @@ void command_add_values( std::string& key_string, std::string& value_string, tex
 		textdb::string_to_vector( key_string, key_terms, db.delimiter() );
 		textdb::string_to_vector( value_string, value_terms, db.delimiter() );
 		
-		// perform search
-		for( auto& item : db.items() )
+		// perform search, literal keys look up the single item
+		query_plan plan( db, key_terms, {}, use_regex, true );
+		plan.for_each( [&]( textdb::item_map::const_iterator item )
 		{
-			if( use_regex ? textdb::compare_vectors_regex_exact( item.first, key_terms ) : textdb::compare_vectors_exact( item.first, key_terms ) )
-			{
-				// store values: iterate over value terms
-				for( auto value_term : value_terms )
-				{
-					if( std::find( item.second.begin(), item.second.end(), value_term ) == item.second.end() )
-						item.second.push_back( value_term );
-				}
-			}
-		}
+			// store values: iterate over value terms
+			for( auto& value_term : value_terms )
+				db.add_value( item, value_term );
+		});
 	}
 	catch( std::exception& e )
 	{
@@ -470,21 +1462,18 @@ void command_add_keys( std::string& key_string, std::string& key_new_string, tex
 		textdb::string_to_vector( key_new_string, new_keys, db.delimiter() );
 		
 		// perform search
-		for( auto& item : db.items() )
+		query_plan plan( db, key_terms, {}, use_regex, true );
+		plan.for_each( [&]( textdb::item_map::const_iterator item )
 		{
-			if( use_regex ? textdb::compare_vectors_regex_exact( item.first, key_terms ) : textdb::compare_vectors_exact( item.first, key_terms ) )
+			// store new keys
+			for( auto new_key : new_keys )
 			{
-				// store new keys
-				for( auto new_key : new_keys )
-				{
-					textdb::keys new_path = item.first;
-					new_path.push_back( new_key );
-					
-					db.items().emplace( new_path, textdb::values() ); //?
-				}
+				textdb::keys new_path = item->first;
+				new_path.push_back( new_key );
 				
+				db.add( new_path ); //?
 			}
-		}
+		});
 	}
 	catch( std::exception& e )
 	{
@@ -501,18 +1490,29 @@ void command_delete_keys( std::string& key_string, textdb& db, std::ostream& out
 		std::vector< std::string > deletion_keys({});
 		textdb::string_to_vector( key_string, deletion_keys, db.delimiter() );
 		
-		std::vector< textdb::keys > results;
-		
-		// iterate over items
-		for( auto& item : db.items() )
+		// literal keys: the item and its subitems are a contiguous range
+		if( !use_regex || textdb::is_literal( deletion_keys ) )
 		{
-			if( use_regex ? textdb::compare_vectors_regex( item.first, deletion_keys ) : textdb::compare_vectors( item.first, deletion_keys ) )
-				results.push_back( item.first );
+			// the range starts at the item, if it exists
+			auto first = db.find( deletion_keys );
+			if( first == db.items().end() )
+			{
+				auto range = db.subtree( deletion_keys );
+				db.erase( range.first, range.second );
+				return;
+			}
+			
+			auto last = std::next( first );
+			while( last != db.items().end() && textdb::compare_vectors( last->first, deletion_keys ) )
+				last++;
+			
+			db.erase( first, last );
+			return;
 		}
 		
-		// delete results
-		for( auto& r : results )
-			db.items().erase( r );
+		// regex: delete matching items while iterating
+		query_plan plan( db, deletion_keys, {}, true, false );
+		plan.for_each( [&db]( textdb::item_map::const_iterator item ){ db.erase( item ); } );
 		
 	}
 	catch( std::exception& e )
@@ -531,35 +1531,32 @@ void command_delete_values( std::string& key_string, std::string& value_string,
 		textdb::string_to_vector( key_string, key_terms, db.delimiter() );
 		textdb::string_to_vector( value_string, value_terms, db.delimiter() );
 		
-		// perform search, iterate over items
-		for( auto& item : db.items() )
+		auto erase_values = [&]( textdb::item_map::const_iterator item )
 		{
-			std::vector< std::string > results;
+			// literal values: hashed lookups and deletes, skip items without matching values
+			if( !use_regex || textdb::is_literal( value_terms ) )
+			{
+				for( auto& value_term : value_terms )
+					db.erase_value( item, value_term );
+				return;
+			}
 			
-			// if paths match
-			if( use_regex ? textdb::compare_vectors_regex_exact( item.first, key_terms ) : textdb::compare_vectors_exact( item.first, key_terms ) )
+			// delete values in a single pass over the item values
+			std::vector< std::regex > value_regexes( value_terms.begin(), value_terms.end() );
+			db.erase_values( item, [&value_regexes]( const std::string& value )
 			{
-				// delete values: iterate over item values
-				for( auto& value : item.second )
+				for( auto& value_regex : value_regexes )
 				{
-					// iterate over item value terms
-					for( auto& value_term : value_terms )
-					{
-						// check value, store in results if value matches
-						if( use_regex ? std::regex_match( value, std::regex(value_term) ) : (value == value_term) )
-							results.push_back( value );
-						
-					}
-					
+					if( std::regex_match( value, value_regex ) )
+						return true;
 				}
-				
-			}
-			
-			// delete values stored in results
-			for( auto& r : results )
-				item.second.erase( std::find( item.second.begin(), item.second.end(), r ) );
-			
-		}
+				return false;
+			} );
+		};
+		
+		// perform search, literal keys look up the single item
+		query_plan plan( db, key_terms, {}, use_regex, true );
+		plan.for_each( erase_values );
 	}
 	catch( std::exception& e )
 	{
@@ -577,43 +1574,38 @@ void command_rename_keys( std::string& keys_old, std::string& keys_new, textdb&
 		textdb::string_to_vector( keys_old, old_key_terms, db.delimiter() );
 		textdb::string_to_vector( keys_new, new_key_terms, db.delimiter() );
 		
-		std::vector< textdb::keys > results_delete; // the old keys for deletion
-		textdb results_add; // the new key-value pairs
+		std::vector< textdb::item_map::const_iterator > results_delete; // the old items for deletion
+		std::map< textdb::keys, textdb::values > results_add; // the new key-value pairs
 		
 		// delete already existing target
 		command_delete_keys( keys_new, db, output, false );
 		
-		// iterate over items
-		for( auto& item : db.items() )
+		// literal keys are a single subtree
+		query_plan plan( db, old_key_terms, {}, use_regex, false );
+		plan.for_each( [&]( textdb::item_map::const_iterator item )
 		{
-			if( use_regex ? textdb::compare_vectors_regex( item.first, old_key_terms ) : textdb::compare_vectors( item.first, old_key_terms ) )
-			{
-				results_delete.push_back( item.first );
-				
-				// build new path
-				textdb::keys new_path = new_key_terms;
-				for( size_t i = old_key_terms.size(); i < item.first.size(); i++ )
-					new_path.push_back( item.first.at(i) );
-				results_add.items().emplace( new_path, item.second );
-				
-				// create new parent items as required
-				while( new_path.size() > 0 ){
-					results_add.items().try_emplace( new_path, textdb::values() );
-					new_path.pop_back();
-				}
-				
-				
+			results_delete.push_back( item );
+			
+			// build new path
+			textdb::keys new_path = new_key_terms;
+			for( size_t i = old_key_terms.size(); i < item->first.size(); i++ )
+				new_path.push_back( item->first.at(i) );
+			results_add.emplace( new_path, item->second );
+			
+			// create new parent items as required
+			while( new_path.size() > 0 ){
+				results_add.try_emplace( new_path, textdb::values() );
+				new_path.pop_back();
 			}
-		}
+		});
 		
 		// delete old items
 		for( auto& r : results_delete )
-			db.items().erase( r );
+			db.erase( r );
 		
 		// add new items
-		// db.items().merge( results_add.items() );
-		for( auto& r : results_add.items() )
-			db.items().insert_or_assign( r.first, r.second );
+		for( auto& r : results_add )
+			db.assign( r.first, r.second );
 		
 	}
 	catch( std::exception& e )
@@ -632,33 +1624,28 @@ void command_copy_keys( std::string& keys_old, std::string& keys_new, textdb& db
 		textdb::string_to_vector( keys_old, old_key_terms, db.delimiter() );
 		textdb::string_to_vector( keys_new, new_key_terms, db.delimiter() );
 		
-		textdb results_add; // the new key-value pairs
+		std::map< textdb::keys, textdb::values > results_add; // the new key-value pairs
 		
-		// iterate over items
-		for( auto& item : db.items() )
+		// literal keys are a single subtree
+		query_plan plan( db, old_key_terms, {}, use_regex, false );
+		plan.for_each( [&]( textdb::item_map::const_iterator item )
 		{
-			if( use_regex ? textdb::compare_vectors_regex( item.first, old_key_terms ) : textdb::compare_vectors( item.first, old_key_terms ) )
-			{
-				// build new path
-				textdb::keys new_path = new_key_terms;
-				for( size_t i = old_key_terms.size(); i < item.first.size(); i++ )
-					new_path.push_back( item.first.at(i) );
-				results_add.items().emplace( new_path, item.second );
-				
-				// create new parent items as required
-				while( new_path.size() > 0 ){
-					results_add.items().try_emplace( new_path, textdb::values() );
-					new_path.pop_back();
-				}
-				
-				
+			// build new path
+			textdb::keys new_path = new_key_terms;
+			for( size_t i = old_key_terms.size(); i < item->first.size(); i++ )
+				new_path.push_back( item->first.at(i) );
+			results_add.emplace( new_path, item->second );
+			
+			// create new parent items as required
+			while( new_path.size() > 0 ){
+				results_add.try_emplace( new_path, textdb::values() );
+				new_path.pop_back();
 			}
-		}
+		});
 		
 		// add new items
-		// db.items().merge( results_add.items() );
-		for( auto& r : results_add.items() )
-			db.items().insert_or_assign( r.first, r.second );
+		for( auto& r : results_add )
+			db.assign( r.first, r.second );
 		
 	}
 	catch( std::exception& e )
@@ -676,20 +1663,20 @@ void command_show_values( std::string& keys, textdb& db, std::ostream& output, b
 		std::vector< std::string > deletion_keys({});
 		textdb::string_to_vector( keys, deletion_keys, db.delimiter() );
 		
-		// iterate over items
-		for( auto& item : db.items() )
+		auto print_values = [&output]( const textdb::values& values )
 		{
-			if( use_regex ? textdb::compare_vectors_regex_exact( item.first, deletion_keys ) : textdb::compare_vectors_exact( item.first, deletion_keys ) ){
-				
-				size_t size = item.second.size();
-				for( auto& value : item.second )
-				{
-					output << value << ((size > 1) ? "\t" : "");
-					size--;
-				}
-				output << "\n";
+			size_t size = values.size();
+			for( auto& value : values )
+			{
+				output << value << ((size > 1) ? "\t" : "");
+				size--;
 			}
-		}
+			output << "\n";
+		};
+		
+		// perform search, literal keys look up the single item
+		query_plan plan( db, deletion_keys, {}, use_regex, true );
+		plan.for_each( [&print_values]( textdb::item_map::const_iterator item ){ print_values( item->second ); } );
 	}
 	catch( std::exception& e )
 	{
@@ -28,9 +28,26 @@
 #include <map>
 #include <regex>
 #include <set>
+#include <unordered_set>
 #include <exception>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <functional>
 
 #include "textdb.h"
+#include "watcher.h"
+#include "cache.h"
+#include "saver.h"
+#include "plan.h"
+#include "compress.h"
+#include "shards.h"
+#include "feed.h"
+#include "diff.h"
 
 /** Takes a line of user input and performs the specified actions on the database
  * Simple actions (e.g. print) are performed directly from this function.
@@ -38,32 +55,123 @@
  */
 void process_input( std::string& input, textdb& db, std::map< std::string, std::string >& options, std::ostream& output );
 
+/// Performs the actions of process_input, without using the result cache
+void process_command( std::string& input, textdb& db, std::map< std::string, std::string >& options, std::ostream& output );
+
+/// Checks if a command only reads the database, the output of these commands can be cached
+bool is_read_only_command( const std::string& input );
+
+/** Runs read only commands (see is_read_only_command) concurrently with process_input,
+ * the output of inputs[i] is written to *outputs[i], done( i ) is called when it is complete
+ */
+void process_read_only_inputs( std::vector< std::string >& inputs, textdb& db, const std::map< std::string, std::string >& options, const std::vector< std::ostream* >& outputs, const std::function< void( size_t ) >& done );
+
 
 // command functions, these are used to perform more complicated actions
 
+/// Reads the depth and fields options, which restrict the output of ls
+textdb::print_options get_print_options( std::map< std::string, std::string >& options, char delimiter );
+
 /// Prints the available commands
 void command_help( std::ostream& output );
 
 /// Prints the number of items in the database
 void command_count( std::ostream& output, textdb& db );
 
+/// Prints the number of items and values and the size of the database
+void command_statistics( std::ostream& output, textdb& db );
+
+/** Prints the size of each subitem of keys, the top-level items if keys is empty
+ * \arg keys the delimiter separated fields of the parent item
+ */
+void command_disk_usage( std::string& keys, textdb& db, std::ostream& output );
+
+/** Print a page of top-level items
+ * \arg after print items after this top-level key, from the start if empty
+ * \arg offset number of top-level items to skip
+ * \arg limit maximum number of top-level items to print
+ */
+void command_list_page( std::string& after, size_t offset, size_t limit, textdb& db, std::ostream& output, bool use_color, const textdb::print_options& projection );
+
 /** Search and print items with matching keys
  * \arg keys the delimiter separated fields of the search term
  */
-void command_search_by_key( std::string& keys, textdb& db, std::ostream& output, bool use_color, bool use_regex );
+void command_search_by_key( std::string& keys, textdb& db, std::ostream& output, bool use_color, bool use_regex, const textdb::print_options& projection );
 
-/** Search and print items with matching keys and values
+/** Search and print items with matching keys and values,
+ * value terms like >x or x..y compare numbers and dates, see value_predicate
  * \arg keys the delimiter separated fields of the key search term
  * \arg values the delimiter separated fields of the value search term
  */ 
-void command_search_by_key_value( std::string& keys, std::string& values, textdb& db, std::ostream& output, bool use_color, bool use_regex );
+void command_search_by_key_value( std::string& keys, std::string& values, textdb& db, std::ostream& output, bool use_color, bool use_regex, const textdb::print_options& projection );
+
+/** Print all items whose last key is the last of keys and whose parents contain the other keys,
+ * using the posting lists of the key elements
+ * \arg keys the delimiter separated key elements, compared as strings
+ * \arg depth only items with this many key elements, 0 for any depth
+ */
+void command_find( std::string& keys, size_t depth, textdb& db, std::ostream& output );
+
+/// Checks if a file is in the tsv format (see export tsv), by the file name extension before a compression extension
+bool is_tsv_file( const std::string& filename );
 
 /// Load database from a file
 void command_load_file( std::string& filename, textdb& db, std::map< std::string, std::string >& options, std::ostream& output );
 
-/// Save database to a file
+/** Import items from a file into the database
+ * \arg replace replace the imported top-level items instead of merging
+ */
+void command_import_file( std::string& filename, textdb& db, std::ostream& output, bool replace );
+
+/** Prints the differences between the database and a file (see diff_items()),
+ * sorted files are compared while they are read, others are loaded first
+ */
+void command_diff_file( std::string& filename, textdb& db, std::ostream& output );
+
+/** Applies the changes made to a copy of the database since base to the database
+ * (see merge_items()), prints the items that were changed in both and kept
+ */
+void command_merge_file( std::string& filename, std::string& base, textdb& db, std::ostream& output );
+
+/** Applies external changes of the opened file while the watch option is on,
+ * called before each command
+ */
+void command_sync_file( file_watcher& watcher, textdb& db, std::map< std::string, std::string >& options, std::ostream& output );
+
+/** Publishes the changes of the database while the publish option is a socket path
+ * and applies the changes of the feed at the socket path of the follow option,
+ * called before and after each command
+ */
+void command_replicate( change_feed& feed, change_follower& follower, textdb& db, std::map< std::string, std::string >& options, std::ostream& output );
+
+/** Save database to a file, a snapshot is written in the background if possible,
+ * a directory is saved as a sharded collection
+ */
 void command_save_file( std::string& filename, textdb& db, std::ostream& output );
 
+/** Save database as a sharded collection, only the changed shards are written
+ * if the directory has the shards of the database
+ */
+void command_save_shards( std::string directory, textdb& db, std::ostream& output );
+
+/// Waits until all background saves are finished and prints their errors
+void command_wait_saves( std::ostream& output );
+
+/** Prints the errors of finished background saves and saves the opened file
+ * while the autosave option is set, called before each command. Also starts
+ * the autosave timer of the saver thread, which saves while the session waits
+ * for input: db and options have to stay valid until command_stop_autosave()
+ */
+void command_background_save( textdb& db, std::map< std::string, std::string >& options, std::ostream& output );
+
+/// Stops the autosave timer, called when the session ends
+void command_stop_autosave();
+
+/** Locks the database against autosaves from the saver thread,
+ * held by the session while it runs a command
+ */
+std::unique_lock< std::mutex > lock_session();
+
 /// Add values to the specified keys
 void command_add_values( std::string& keys, std::string& values, textdb& db, std::ostream& output, bool use_regex );
 
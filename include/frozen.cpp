@@ -0,0 +1,131 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+// Member functions for frozen_items
+
+#include "frozen.h"
+
+void frozen_items::open( size_t depth, const std::string& key )
+{
+	size_t index = _nodes.size();
+	
+	// close items at the same or a higher depth
+	while( _open.size() >= depth && !_open.empty() )
+	{
+		_nodes[_open.back()].subtree_end = index;
+		_open.pop_back();
+	}
+	
+	// key ID, identical key elements are stored once
+	auto key_id = _key_ids.find( key );
+	if( key_id == _key_ids.end() )
+		key_id = _key_ids.emplace( key, add_string( key ) ).first;
+	
+	node n;
+	n.depth = depth;
+	n.key_size = key.size();
+	n.key = key_id->second;
+	n.parent = _open.empty() ? npos : _open.back();
+	n.values_begin = _values.size();
+	n.values_end = _values.size();
+	n.subtree_end = npos;
+	
+	_nodes.push_back( n );
+	_open.push_back( index );
+}
+
+void frozen_items::finish()
+{
+	for( auto i : _open )
+		_nodes[i].subtree_end = _nodes.size();
+	_open.clear();
+	
+	// the key IDs are not needed for reading
+	_key_ids = std::unordered_map< std::string, size_t >();
+	
+	_nodes.shrink_to_fit();
+	_values.shrink_to_fit();
+	_strings.shrink_to_fit();
+}
+
+size_t frozen_items::add_string( const std::string& s )
+{
+	size_t offset = _strings.size();
+	_strings.append( s );
+	return offset;
+}
+
+int frozen_items::compare( size_t i, const std::vector< std::string >& path ) const
+{
+	// lexicographical comparison
+	int c = compare_keys( i, path );
+	if( c != 0 )
+		return c;
+	
+	size_t depth = _nodes[i].depth;
+	if( depth == path.size() )
+		return 0;
+	return depth < path.size() ? -1 : 1;
+}
+
+int frozen_items::compare_keys( size_t i, const std::vector< std::string >& path ) const
+{
+	// the parents come first, the recursion walks up without allocating
+	const node& n = _nodes[i];
+	if( n.parent != npos )
+	{
+		int c = compare_keys( n.parent, path );
+		if( c != 0 )
+			return c;
+	}
+	
+	if( n.depth > path.size() )
+		return 0;
+	return key( i ).compare( path[n.depth-1] );
+}
+
+size_t frozen_items::lower_bound( const std::vector< std::string >& path ) const
+{
+	size_t first = 0, count = _nodes.size();
+	
+	while( count > 0 )
+	{
+		size_t step = count / 2;
+		if( compare( first + step, path ) < 0 )
+		{
+			first += step + 1;
+			count -= step + 1;
+		}
+		else
+			count = step;
+	}
+	
+	return first;
+}
+
+std::pair< size_t, size_t > frozen_items::subtree( const std::vector< std::string >& path ) const
+{
+	if( path.empty() )
+		return { 0, _nodes.size() };
+	
+	size_t first = lower_bound( path );
+	if( first == _nodes.size() || compare( first, path ) != 0 )
+		return { first, first };
+	
+	return { first, _nodes[first].subtree_end };
+}
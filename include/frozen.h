@@ -0,0 +1,119 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+// Frozen (read optimized) item layout header
+
+#ifndef TEXTDB_FROZEN
+#define TEXTDB_FROZEN
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <cstdint>
+
+/** Flat, read only copy of a collection.
+ * Items are stored in pre-order (the order of the item map) in one array,
+ * all key and value bytes are stored in one contiguous string. Identical key
+ * elements are stored once, their offset in the string is used as key ID.
+ */
+class frozen_items
+{
+	
+	public:
+		
+		/// A single item
+		struct node
+		{
+			/// Number of key elements
+			uint32_t depth;
+			/// Size of the last key element
+			uint32_t key_size;
+			/// Offset of the last key element in _strings, the key ID
+			size_t key;
+			/// Index of the parent item, npos for top level items
+			size_t parent;
+			/// Range of the item values in _values
+			size_t values_begin, values_end;
+			/// Index of the first item after this item and its subitems
+			size_t subtree_end;
+		};
+		
+		static const size_t npos = SIZE_MAX;
+		
+		/// Appends an item, items have to be appended in pre-order
+		template< class value_range > void push_back( size_t depth, const std::string& key, const value_range& values )
+		{
+			open( depth, key );
+			for( auto& value : values )
+				_values.push_back( { add_string( value ), value.size() } );
+			_nodes.back().values_end = _values.size();
+		}
+		
+		/// Finishes building, must be called after the last push_back()
+		void finish();
+		
+		size_t size() const { return _nodes.size(); }
+		const node& at( size_t i ) const { return _nodes[i]; }
+		
+		/// Returns the last key element of item i
+		std::string_view key( size_t i ) const { return std::string_view( _strings.data() + _nodes[i].key, _nodes[i].key_size ); }
+		
+		/// Returns value j, j is in [ at(i).values_begin, at(i).values_end )
+		std::string_view value( size_t j ) const { return std::string_view( _strings.data() + _values[j].first, _values[j].second ); }
+		
+		/** Returns the index of the first item with a path not less than path
+		 * (binary search, like std::map::lower_bound)
+		 */
+		size_t lower_bound( const std::vector< std::string >& path ) const;
+		
+		/// Returns the range of items that start with path
+		std::pair< size_t, size_t > subtree( const std::vector< std::string >& path ) const;
+		
+	private:
+		
+		/// All items in pre-order
+		std::vector< node > _nodes;
+		
+		/// Offset and size of all values in _strings
+		std::vector< std::pair< size_t, size_t > > _values;
+		
+		/// All key and value bytes
+		std::string _strings;
+		
+		/// Items that are still open during building, one per depth
+		std::vector< size_t > _open;
+		
+		/// Key element → offset in _strings, used only during building
+		std::unordered_map< std::string, size_t > _key_ids;
+		
+		/// Adds an item without values
+		void open( size_t depth, const std::string& key );
+		
+		/// Appends a string to _strings, \returns the offset
+		size_t add_string( const std::string& s );
+		
+		/// Compares the path of item i with path, like std::string::compare
+		int compare( size_t i, const std::vector< std::string >& path ) const;
+		
+		/// Compares the key elements of item i and its parents with the same elements of path
+		int compare_keys( size_t i, const std::vector< std::string >& path ) const;
+		
+};
+
+#endif
@@ -0,0 +1,247 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+// Member functions for query_plan and the filters of a plan
+
+#include "plan.h"
+
+#include <regex>
+#include <algorithm>
+
+namespace
+{
+	typedef textdb::item_map::const_iterator item_iterator;
+	
+	/// A filter that keeps the items for which test returns true
+	template< class test > class item_filter : public plan_filter
+	{
+		public:
+			
+			explicit item_filter( test t ) : _test( std::move( t ) ) {}
+			
+			size_t filter( item_iterator* items, size_t count ) const override
+			{
+				size_t kept = 0;
+				for( size_t i = 0; i < count; i++ )
+				{
+					if( _test( *items[i] ) )
+						items[kept++] = items[i];
+				}
+				return kept;
+			}
+			
+		private:
+			
+			test _test;
+	};
+	
+	template< class test > std::unique_ptr< plan_filter > make_filter( test t )
+	{
+		return std::make_unique< item_filter< test > >( std::move( t ) );
+	}
+	
+	/// Items with as many key elements as there are terms (exact) or at least as many
+	template< bool exact > struct length_test
+	{
+		size_t length;
+		
+		bool operator()( const textdb::item_map::value_type& item ) const
+		{
+			return exact ? item.first.size() == length : item.first.size() >= length;
+		}
+	};
+	
+	/// Items with the key element term at position, follows a length_test
+	struct literal_key_test
+	{
+		size_t position;
+		std::string term;
+		
+		bool operator()( const textdb::item_map::value_type& item ) const { return item.first[position] == term; }
+	};
+	
+	/// Items with one of the key elements that match a regex at position, follows a length_test
+	struct regex_key_test
+	{
+		size_t position;
+		std::unordered_set< std::string > matching;
+		
+		bool operator()( const textdb::item_map::value_type& item ) const { return matching.count( item.first[position] ) != 0; }
+	};
+	
+	/// Items with the value term, a hashed lookup
+	struct literal_value_test
+	{
+		std::string term;
+		
+		bool operator()( const textdb::item_map::value_type& item ) const { return item.second.contains( term ); }
+	};
+	
+	/// Items with a value that matches a regex
+	struct regex_value_test
+	{
+		std::regex term;
+		
+		bool operator()( const textdb::item_map::value_type& item ) const
+		{
+			return std::any_of( item.second.begin(), item.second.end(), [this]( const std::string& value ){ return std::regex_match( value, term ); } );
+		}
+	};
+	
+	/// Items with a number or date value in the range of a typed term
+	struct typed_value_test
+	{
+		value_predicate term;
+		
+		bool operator()( const textdb::item_map::value_type& item ) const
+		{
+			return std::any_of( item.second.begin(), item.second.end(), [this]( const std::string& value ){ return term.matches( value ); } );
+		}
+	};
+}
+
+query_plan::query_plan( const textdb& db, const textdb::keys& key_terms, const textdb::keys& value_terms, bool use_regex, bool exact ) :
+	_db( db ), _key_terms( key_terms )
+{
+	std::vector< value_predicate > predicates( value_terms.size() );
+	std::vector< bool > typed( value_terms.size() );
+	for( size_t i = 0; i < value_terms.size(); i++ )
+		typed[i] = predicates[i].parse( value_terms[i] );
+	
+	// pick the items to look at
+	bool literal_keys = !use_regex || textdb::is_literal( key_terms );
+	if( literal_keys && exact )
+		_access = access::lookup;
+	else if( exact && value_terms.size() == 1 && typed.front() && !key_terms.empty() && textdb::is_literal( key_terms.back() ) && db.has_index( key_terms.back() ) )
+	{
+		_access = access::index;
+		_range = predicates.front();
+	}
+	else if( literal_keys )
+		_access = access::subtree;
+	
+	// lookups and subtrees only contain items with the keys, the other filters run cheapest first
+	if( _access != access::lookup && _access != access::subtree )
+	{
+		if( exact )
+			_filters.push_back( make_filter( length_test< true >{ key_terms.size() } ) );
+		else
+			_filters.push_back( make_filter( length_test< false >{ key_terms.size() } ) );
+		
+		for( size_t i = 0; i < key_terms.size(); i++ )
+		{
+			if( !use_regex || textdb::is_literal( key_terms[i] ) )
+				_filters.push_back( make_filter( literal_key_test{ i, key_terms[i] } ) );
+		}
+		
+		for( size_t i = 0; i < key_terms.size(); i++ )
+		{
+			if( !use_regex || textdb::is_literal( key_terms[i] ) )
+				continue;
+			
+			// evaluate the regex once per distinct key element
+			regex_key_test test{ i, {} };
+			std::regex term( key_terms[i] );
+			for( auto& segment : db.segments( i ) )
+			{
+				if( std::regex_match( segment.first, term ) )
+					test.matching.insert( segment.first );
+			}
+			_filters.push_back( make_filter( std::move( test ) ) );
+		}
+	}
+	
+	for( size_t i = 0; i < value_terms.size(); i++ )
+	{
+		if( !typed[i] && ( !use_regex || textdb::is_literal( value_terms[i] ) ) )
+			_filters.push_back( make_filter( literal_value_test{ value_terms[i] } ) );
+	}
+	for( size_t i = 0; i < value_terms.size(); i++ )
+	{
+		if( typed[i] )
+			_filters.push_back( make_filter( typed_value_test{ predicates[i] } ) );
+	}
+	for( size_t i = 0; i < value_terms.size(); i++ )
+	{
+		if( !typed[i] && use_regex && !textdb::is_literal( value_terms[i] ) )
+			_filters.push_back( make_filter( regex_value_test{ std::regex( value_terms[i] ) } ) );
+	}
+}
+
+void query_plan::for_each( const std::function< void( textdb::item_map::const_iterator ) >& found ) const
+{
+	item_iterator batch[batch_size];
+	
+	switch( _access )
+	{
+		case access::lookup:
+		{
+			batch[0] = _db.find( _key_terms );
+			if( batch[0] != _db.items().end() )
+				run( batch, 1, found );
+			return;
+		}
+		
+		case access::index:
+		{
+			// found may change the index, take all items in the range first
+			std::vector< item_iterator > items;
+			_db.find_range( _key_terms.back(), _range, [&]( const textdb::item_map::value_type& item )
+			{
+				items.push_back( _db.items().find( item.first ) );
+			});
+			
+			for( size_t first = 0; first < items.size(); first += batch_size )
+			{
+				size_t count = std::min( batch_size, items.size() - first );
+				std::copy_n( items.begin() + first, count, batch );
+				run( batch, count, found );
+			}
+			return;
+		}
+		
+		case access::subtree:
+		case access::scan:
+		{
+			auto range = ( _access == access::subtree ) ? _db.subtree( _key_terms ) : std::make_pair( _db.items().begin(), _db.items().end() );
+			
+			// the next item is taken before found is called, so found may delete the items of the batch
+			for( auto item = range.first; item != range.second; )
+			{
+				size_t count = 0;
+				while( item != range.second && count < batch_size )
+					batch[count++] = item++;
+				run( batch, count, found );
+			}
+			return;
+		}
+	}
+}
+
+void query_plan::run( textdb::item_map::const_iterator* items, size_t count, const std::function< void( textdb::item_map::const_iterator ) >& found ) const
+{
+	for( auto& f : _filters )
+	{
+		count = f->filter( items, count );
+		if( count == 0 )
+			return;
+	}
+	
+	for( size_t i = 0; i < count; i++ )
+		found( items[i] );
+}
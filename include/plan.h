@@ -0,0 +1,94 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+// Query plan header
+
+#ifndef TEXTDB_PLAN
+#define TEXTDB_PLAN
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <unordered_set>
+
+#include "textdb.h"
+#include "predicate.h"
+
+/// A step of a query plan, removes the items that don't match from a batch
+class plan_filter
+{
+	
+	public:
+		
+		virtual ~plan_filter() {}
+		
+		/** Moves the matching items of items[0, count) to the front, keeping their order
+		 * \returns the number of matching items
+		 */
+		virtual size_t filter( textdb::item_map::const_iterator* items, size_t count ) const = 0;
+		
+};
+
+/** Key and value search terms compiled for a database: the plan picks the
+ * items to look at (a single item, a subtree, a range of a numeric index or
+ * all items) and a pipeline of filters specialized for the kind of each term.
+ * Items are evaluated in batches, each filter runs over a whole batch.
+ * A plan is only valid until the database changes.
+ */
+class query_plan
+{
+	
+	public:
+		
+		/** \arg key_terms keys to match, regex if use_regex is true
+		 * \arg value_terms every term has to match a value of the item, typed terms
+		 * (see value_predicate) compare numbers and dates
+		 * \arg exact match only items with as many key elements as key_terms, otherwise
+		 * items starting with key_terms
+		 */
+		query_plan( const textdb& db, const textdb::keys& key_terms, const textdb::keys& value_terms, bool use_regex, bool exact );
+		
+		/** Calls found for every matching item in order, found may delete the item
+		 * it is called for but no other items
+		 */
+		void for_each( const std::function< void( textdb::item_map::const_iterator ) >& found ) const;
+		
+	private:
+		
+		/// The items the filters are applied to
+		enum class access { lookup, subtree, index, scan };
+		
+		const textdb& _db;
+		textdb::keys _key_terms;
+		access _access = access::scan;
+		
+		/// Range predicate for access::index
+		value_predicate _range;
+		
+		std::vector< std::unique_ptr< plan_filter > > _filters;
+		
+		/// Number of items per batch
+		static constexpr size_t batch_size = 256;
+		
+		/// Applies the filters to a batch and calls found for the remaining items
+		void run( textdb::item_map::const_iterator* items, size_t count, const std::function< void( textdb::item_map::const_iterator ) >& found ) const;
+		
+};
+
+#endif
@@ -0,0 +1,118 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+// Member functions for value_predicate
+
+#include "predicate.h"
+
+#include <cstdlib>
+#include <cmath>
+#include <limits>
+
+bool value_predicate::parse( const std::string& term )
+{
+	const double infinity = std::numeric_limits< double >::infinity();
+	double number;
+	
+	// range
+	size_t dots = term.find( ".." );
+	if( dots != std::string::npos )
+	{
+		_low_inclusive = _high_inclusive = true;
+		return to_number( std::string_view( term ).substr( 0, dots ), _low ) &&
+			to_number( std::string_view( term ).substr( dots+2 ), _high );
+	}
+	
+	// comparison
+	for( auto op : { ">=", "<=", ">", "<" } )
+	{
+		std::string_view prefix( op );
+		if( term.compare( 0, prefix.size(), prefix ) != 0 )
+			continue;
+		
+		if( !to_number( std::string_view( term ).substr( prefix.size() ), number ) )
+			return false;
+		
+		bool greater = ( prefix[0] == '>' );
+		bool inclusive = ( prefix.size() == 2 );
+		
+		_low = greater ? number : -infinity;
+		_high = greater ? infinity : number;
+		_low_inclusive = greater ? inclusive : true;
+		_high_inclusive = greater ? true : inclusive;
+		return true;
+	}
+	
+	return false;
+}
+
+bool value_predicate::to_number( std::string_view value, double& number )
+{
+	if( value.empty() )
+		return false;
+	
+	// number
+	std::string text( value );
+	char* end;
+	number = std::strtod( text.c_str(), &end );
+	if( *end == '\0' && !std::isnan( number ) )
+		return true;
+	
+	// date: YYYY-MM-DD[( |T)HH:MM[:SS]]
+	int year, month, day, hour = 0, minute = 0, second = 0;
+	auto digits = [&text]( size_t position, size_t count, int& result )
+	{
+		if( position + count > text.size() )
+			return false;
+		
+		result = 0;
+		for( size_t i = position; i < position + count; i++ )
+		{
+			if( text[i] < '0' || text[i] > '9' )
+				return false;
+			result = result*10 + ( text[i] - '0' );
+		}
+		return true;
+	};
+	
+	if( !digits( 0, 4, year ) || text[4] != '-' || !digits( 5, 2, month ) || text[7] != '-' || !digits( 8, 2, day ) )
+		return false;
+	
+	if( text.size() > 10 )
+	{
+		if( ( text[10] != ' ' && text[10] != 'T' ) || !digits( 11, 2, hour ) || text.size() < 16 || text[13] != ':' || !digits( 14, 2, minute ) )
+			return false;
+		
+		if( text.size() > 16 && ( text[16] != ':' || !digits( 17, 2, second ) || text.size() != 19 ) )
+			return false;
+	}
+	
+	if( month < 1 || month > 12 || day < 1 || day > 31 )
+		return false;
+	
+	// days since 1970-01-01 in the proleptic Gregorian calendar
+	int y = year - ( month <= 2 );
+	int era = ( y >= 0 ? y : y-399 ) / 400;
+	int year_of_era = y - era * 400;
+	int day_of_year = ( 153 * ( month + ( month > 2 ? -3 : 9 ) ) + 2 ) / 5 + day - 1;
+	int day_of_era = year_of_era * 365 + year_of_era/4 - year_of_era/100 + day_of_year;
+	long days = (long)era * 146097 + day_of_era - 719468;
+	
+	number = days * 86400.0 + hour * 3600 + minute * 60 + second;
+	return true;
+}
@@ -0,0 +1,73 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+// Typed value predicate header
+
+#ifndef TEXTDB_PREDICATE
+#define TEXTDB_PREDICATE
+
+#include <string>
+#include <string_view>
+
+/** A comparison of values as numbers or dates:
+ * >x, >=x, <x, <=x and x..y (both inclusive), x and y are numbers
+ * or dates (YYYY-MM-DD with an optional time HH:MM[:SS]).
+ */
+class value_predicate
+{
+	
+	public:
+		
+		/** Parses a search term
+		 * \returns false if term is not a typed predicate
+		 */
+		bool parse( const std::string& term );
+		
+		/// Checks if a value matches, values that are no number or date never match
+		bool matches( std::string_view value ) const
+		{
+			double number;
+			return to_number( value, number ) && matches( number );
+		}
+		
+		/// Checks if a number matches
+		bool matches( double number ) const
+		{
+			return ( number > _low || ( _low_inclusive && number == _low ) ) &&
+				( number < _high || ( _high_inclusive && number == _high ) );
+		}
+		
+		/// The range of matching numbers
+		double low() const { return _low; }
+		double high() const { return _high; }
+		bool low_inclusive() const { return _low_inclusive; }
+		bool high_inclusive() const { return _high_inclusive; }
+		
+		/** Converts a number or a date (to seconds since 1970-01-01 UTC)
+		 * \returns false if value is neither
+		 */
+		static bool to_number( std::string_view value, double& number );
+		
+	private:
+		
+		double _low, _high;
+		bool _low_inclusive, _high_inclusive;
+		
+};
+
+#endif
@@ -0,0 +1,140 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+// Single producer single consumer queue header
+
+#ifndef TEXTDB_QUEUE
+#define TEXTDB_QUEUE
+
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <utility>
+
+/** Bounded queue between exactly one producer and one consumer thread.
+ * Elements are passed through a ring buffer without locking, the mutex is
+ * only used to sleep while the queue is full or empty for a longer time.
+ */
+template< class T > class spsc_queue
+{
+	
+	public:
+		
+		explicit spsc_queue( size_t capacity ) : _slots( capacity+1 ) {}
+		
+		spsc_queue( const spsc_queue& ) = delete;
+		spsc_queue& operator=( const spsc_queue& ) = delete;
+		
+		/// Appends value, waits while the queue is full, called by the producer
+		void push( T value )
+		{
+			size_t tail = _tail.load( std::memory_order_relaxed );
+			size_t next = advance( tail );
+			wait( _producer_sleeping, [&]{ return next != _head.load(); } );
+			
+			_slots[tail] = std::move( value );
+			_tail.store( next );
+			wake( _consumer_sleeping );
+		}
+		
+		/// Takes the first element without waiting, \returns false if the queue is empty
+		bool try_pop( T& value )
+		{
+			size_t head = _head.load( std::memory_order_relaxed );
+			if( head == _tail.load() )
+				return false;
+			
+			value = std::move( _slots[head] );
+			_head.store( advance( head ) );
+			wake( _producer_sleeping );
+			return true;
+		}
+		
+		/** Takes the first element, waits while the queue is empty, called by the consumer
+		 * \returns false if the queue is empty and closed
+		 */
+		bool pop( T& value )
+		{
+			wait( _consumer_sleeping, [&]{ return _head.load( std::memory_order_relaxed ) != _tail.load() || _closed.load(); } );
+			return try_pop( value );
+		}
+		
+		/// Checks if the queue is empty, called by the consumer
+		bool empty() const { return _head.load( std::memory_order_relaxed ) == _tail.load(); }
+		
+		/// Checks if close() was called
+		bool closed() const { return _closed.load(); }
+		
+		/// Tells the consumer that nothing follows, called by the producer
+		void close()
+		{
+			_closed = true;
+			wake( _consumer_sleeping );
+		}
+		
+	private:
+		
+		/// One slot always stays free to tell a full from an empty queue
+		std::vector< T > _slots;
+		
+		/// Next element to take and next free slot
+		std::atomic< size_t > _head{ 0 }, _tail{ 0 };
+		
+		std::atomic< bool > _closed{ false };
+		
+		/// Set while the producer or the consumer sleeps in wait(), each side has its own flag
+		/// so that one side waking up can't hide that the other one sleeps
+		std::atomic< bool > _producer_sleeping{ false }, _consumer_sleeping{ false };
+		
+		std::mutex _mutex;
+		std::condition_variable _wake;
+		
+		size_t advance( size_t i ) const { return ( i+1 < _slots.size() ) ? i+1 : 0; }
+		
+		/// Spins for a short time, then sleeps with sleeping set until ready returns true
+		template< class predicate > void wait( std::atomic< bool >& sleeping, predicate ready )
+		{
+			for( int spin = 0; spin < 64; spin++ )
+			{
+				if( ready() )
+					return;
+				std::this_thread::yield();
+			}
+			
+			std::unique_lock< std::mutex > lock( _mutex );
+			sleeping = true;
+			while( !ready() )
+				_wake.wait( lock );
+			sleeping = false;
+		}
+		
+		/// Wakes up the other thread if its sleeping flag is set
+		void wake( const std::atomic< bool >& sleeping )
+		{
+			if( sleeping )
+			{
+				std::lock_guard< std::mutex > lock( _mutex );
+				_wake.notify_all();
+			}
+		}
+		
+};
+
+#endif
@@ -0,0 +1,235 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+// Member functions for background_saver
+
+#include "saver.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <sys/stat.h>
+
+background_saver::~background_saver()
+{
+	{
+		std::lock_guard< std::mutex > lock( _mutex );
+		_stop = true;
+	}
+	_changed.notify_all();
+	
+	if( _thread.joinable() )
+		_thread.join();
+}
+
+bool background_saver::save( textdb& db, const std::string& filename, bool tsv )
+{
+	// the snapshot is taken now, later changes don't affect the file
+	auto items = db.snapshot();
+	if( !items )
+		return false;
+	
+	add( { items, filename, db.delimiter(), tsv, 0, items->size(), 0 } );
+	return true;
+}
+
+void background_saver::save( const std::shared_ptr< const frozen_items >& items, char delimiter, const std::string& filename, size_t first, size_t last, uint64_t tag )
+{
+	add( { items, filename, delimiter, false, first, last, tag } );
+}
+
+void background_saver::add( job&& j )
+{
+	{
+		std::lock_guard< std::mutex > lock( _mutex );
+		
+		// only the newest snapshot of a file has to be written
+		bool replaced = false;
+		for( auto& pending : _jobs )
+			if( pending.filename == j.filename )
+			{
+				pending = j;
+				replaced = true;
+			}
+		
+		if( !replaced )
+			_jobs.push_back( std::move( j ) );
+		
+		if( !_thread.joinable() )
+			_thread = std::thread( &background_saver::run, this );
+	}
+	_changed.notify_all();
+}
+
+void background_saver::wait()
+{
+	std::unique_lock< std::mutex > lock( _mutex );
+	_changed.wait( lock, [this]{ return _jobs.empty() && _current.empty(); } );
+}
+
+std::vector< std::string > background_saver::pending() const
+{
+	std::lock_guard< std::mutex > lock( _mutex );
+	
+	std::vector< std::string > result;
+	if( !_current.empty() )
+		result.push_back( _current );
+	for( auto& j : _jobs )
+		result.push_back( j.filename );
+	
+	return result;
+}
+
+std::vector< std::string > background_saver::errors()
+{
+	std::lock_guard< std::mutex > lock( _mutex );
+	
+	std::vector< std::string > result;
+	result.swap( _errors );
+	return result;
+}
+
+std::vector< background_saver::saved_file > background_saver::saved()
+{
+	std::lock_guard< std::mutex > lock( _mutex );
+	
+	std::vector< saved_file > result;
+	result.swap( _saved );
+	return result;
+}
+
+void background_saver::set_timer( std::chrono::seconds interval, std::function< void() > request )
+{
+	{
+		std::lock_guard< std::mutex > lock( _mutex );
+		if( interval == _interval )
+			return;
+		
+		_interval = interval;
+		_request = std::move( request );
+		_next_tick = std::chrono::steady_clock::now() + interval;
+		
+		if( !_thread.joinable() && interval.count() > 0 )
+			_thread = std::thread( &background_saver::run, this );
+	}
+	_changed.notify_all();
+}
+
+void background_saver::run()
+{
+	std::unique_lock< std::mutex > lock( _mutex );
+	
+	while( true )
+	{
+		if( _jobs.empty() )
+		{
+			// pending saves are finished before stopping
+			if( _stop )
+				return;
+			
+			auto now = std::chrono::steady_clock::now();
+			if( _interval.count() > 0 && now >= _next_tick )
+			{
+				_next_tick = now + _interval;
+				auto request = _request;
+				lock.unlock();
+				request();
+				lock.lock();
+				continue;
+			}
+			
+			// wait for a job, the timer or a change of the timer
+			if( _interval.count() > 0 )
+				_changed.wait_until( lock, _next_tick );
+			else
+				_changed.wait( lock );
+			continue;
+		}
+		
+		job j = std::move( _jobs.front() );
+		_jobs.pop_front();
+		_current = j.filename;
+		
+		// write without holding the lock
+		lock.unlock();
+		saved_file saved{ j.filename, j.tag, 0, 0, 0, 0 };
+		std::string error = write( j, saved );
+		j.items.reset();
+		lock.lock();
+		
+		if( !error.empty() )
+			_errors.push_back( error );
+		else
+			_saved.push_back( std::move( saved ) );
+		_current.clear();
+		_changed.notify_all();
+	}
+}
+
+std::string background_saver::write( const job& j, saved_file& saved )
+{
+	// replace the file a symlink points to, not the symlink
+	std::string target = j.filename;
+	if( char* resolved = realpath( j.filename.c_str(), nullptr ) )
+	{
+		target = resolved;
+		std::free( resolved );
+	}
+	
+	std::string temp = target + ".saving";
+	output_file outfile( temp, compression_for_name( j.filename ) );
+	
+	if( !outfile.is_open() )
+		return "Could not open " + j.filename;
+	
+	if( j.tsv )
+		textdb::to_tsv( outfile, *j.items );
+	else
+		textdb::print( outfile, *j.items, j.delimiter, j.first, j.last );
+	
+	if( !outfile.close() )
+	{
+		std::remove( temp.c_str() );
+		return "Could not write " + j.filename;
+	}
+	
+	// keep the permissions of the replaced file
+	struct stat file_stat;
+	if( stat( target.c_str(), &file_stat ) == 0 )
+		chmod( temp.c_str(), file_stat.st_mode & 07777 );
+	
+	// the file keeps its inode and modification time when it is renamed
+	if( stat( temp.c_str(), &file_stat ) == 0 )
+	{
+		saved.device = file_stat.st_dev;
+		saved.inode = file_stat.st_ino;
+#ifdef __linux__
+		saved.mtime = (int64_t)file_stat.st_mtim.tv_sec * 1000000000 + file_stat.st_mtim.tv_nsec;
+#else
+		saved.mtime = (int64_t)file_stat.st_mtime * 1000000000;
+#endif
+		saved.size = file_stat.st_size;
+	}
+	
+	if( std::rename( temp.c_str(), target.c_str() ) != 0 )
+	{
+		std::remove( temp.c_str() );
+		return "Could not write " + j.filename;
+	}
+	
+	return std::string();
+}
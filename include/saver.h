@@ -0,0 +1,153 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+// Background saver header
+
+#ifndef TEXTDB_SAVER
+#define TEXTDB_SAVER
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
+#include <utility>
+
+#include "textdb.h"
+#include "compress.h"
+
+/** Writes snapshots of databases to files on a background thread, so
+ * saving doesn't block the session. Files are written to a temporary file
+ * first and renamed, a file is never left half written. The temporary file
+ * gets the mode of the file it replaces, symlinks are followed.
+ */
+class background_saver
+{
+	
+	public:
+		
+		background_saver() {}
+		
+		/// Finishes all pending saves
+		~background_saver();
+		
+		background_saver( const background_saver& ) = delete;
+		background_saver& operator=( const background_saver& ) = delete;
+		
+		/** Saves a snapshot of db to filename, in tsv format if tsv is true,
+		 * compressed by the extension of filename (see compression_for_name()),
+		 * a pending save of the same file is replaced
+		 * \returns false if no snapshot of db can be taken, nothing is saved then
+		 */
+		bool save( textdb& db, const std::string& filename, bool tsv );
+		
+		/** Saves the items [first, last) of a snapshot (see textdb::snapshot()) to filename in the file format,
+		 * compressed by the extension of filename, a pending save of the same file is replaced.
+		 * saved() reports the file with tag once it is written.
+		 */
+		void save( const std::shared_ptr< const frozen_items >& items, char delimiter, const std::string& filename, size_t first, size_t last, uint64_t tag = 0 );
+		
+		/// Blocks until all saves are finished
+		void wait();
+		
+		/// Returns the names of the files that are not saved yet, in order
+		std::vector< std::string > pending() const;
+		
+		/// Returns and forgets the errors of finished saves
+		std::vector< std::string > errors();
+		
+		/// A file written by the saver
+		struct saved_file
+		{
+			std::string filename;
+			/// Tag of the save
+			uint64_t tag;
+			/// What stat(2) reported about the written file before it replaced the old one
+			uint64_t device, inode;
+			/// Modification time in nanoseconds
+			int64_t mtime;
+			size_t size;
+		};
+		
+		/// Returns and forgets the files written since the last call, in order
+		std::vector< saved_file > saved();
+		
+		/** Calls request on the saver thread every interval, e.g. to autosave while
+		 * the session waits for input, an interval of 0 stops the timer.
+		 * The timer keeps running if the interval doesn't change.
+		 */
+		void set_timer( std::chrono::seconds interval, std::function< void() > request );
+		
+	private:
+		
+		/// A file to save
+		struct job
+		{
+			std::shared_ptr< const frozen_items > items;
+			std::string filename;
+			char delimiter;
+			bool tsv;
+			/// The saved items
+			size_t first, last;
+			uint64_t tag;
+		};
+		
+		/// Adds a job, replaces a pending job for the same file
+		void add( job&& j );
+		
+		/// Saves not started yet
+		std::deque< job > _jobs;
+		
+		/// File being saved, empty if idle
+		std::string _current;
+		
+		/// Errors of finished saves
+		std::vector< std::string > _errors;
+		
+		/// Written files
+		std::vector< saved_file > _saved;
+		
+		/// Is the thread asked to stop
+		bool _stop = false;
+		
+		/// Timer of set_timer(), off if _interval is 0
+		std::chrono::seconds _interval{ 0 };
+		std::chrono::steady_clock::time_point _next_tick;
+		std::function< void() > _request;
+		
+		mutable std::mutex _mutex;
+		
+		/// Signals new jobs, finished jobs and timer changes
+		std::condition_variable _changed;
+		
+		/// Started with the first save
+		std::thread _thread;
+		
+		/// Main function of the thread
+		void run();
+		
+		/// Writes a job to its file and describes it in saved, \returns an error message or an empty string
+		static std::string write( const job& j, saved_file& saved );
+		
+};
+
+#endif
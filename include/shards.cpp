@@ -0,0 +1,187 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+// Sharded collections
+
+#include "shards.h"
+#include "compress.h"
+
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+#include <thread>
+#include <atomic>
+#include <filesystem>
+
+/// Name of the manifest file in the directory of a sharded collection
+static const char* const manifest_name = "manifest";
+
+/// First line of a manifest
+static const char* const manifest_header = "text-db shards";
+
+bool shard_manifest::is_sharded( const std::string& path )
+{
+	std::error_code error;
+	return std::filesystem::is_directory( path, error ) && std::filesystem::exists( path + "/" + manifest_name, error );
+}
+
+bool shard_manifest::read( const std::string& directory )
+{
+	files.clear();
+	first_keys.clear();
+	
+	std::ifstream input( directory + "/" + manifest_name );
+	std::string line;
+	if( !std::getline( input, line ) || line != manifest_header )
+		return false;
+	
+	while( std::getline( input, line ) )
+	{
+		size_t tab = line.find( '\t' );
+		if( tab == std::string::npos || tab == 0 )
+			return false;
+		
+		files.push_back( line.substr( 0, tab ) );
+		first_keys.push_back( line.substr( tab+1 ) );
+	}
+	
+	// the first shard holds everything before the second
+	return !files.empty() && first_keys.front().empty();
+}
+
+bool shard_manifest::write( const std::string& directory ) const
+{
+	std::string path = directory + "/" + manifest_name;
+	std::string temp = path + ".saving";
+	
+	std::ofstream output( temp );
+	output << manifest_header << "\n";
+	for( size_t i = 0; i < files.size(); i++ )
+		output << files[i] << "\t" << first_keys[i] << "\n";
+	output.close();
+	
+	if( !output || std::rename( temp.c_str(), path.c_str() ) != 0 )
+	{
+		std::remove( temp.c_str() );
+		return false;
+	}
+	
+	return true;
+}
+
+shard_manifest shard_manifest::split( const textdb& db, size_t shard_size, const std::vector< std::string >& taken )
+{
+	shard_manifest result;
+	size_t size = shard_size;
+	size_t number = 0;
+	
+	// the next shard-NNNN name that isn't taken
+	auto next_name = [&]()
+	{
+		char name[32];
+		do
+			std::snprintf( name, sizeof( name ), "shard-%04zu", number++ );
+		while( std::find( taken.begin(), taken.end(), name ) != taken.end() );
+		
+		return std::string( name );
+	};
+	
+	for( auto& item : db.items() )
+	{
+		if( item.first.size() != 1 )
+			continue;
+		
+		// start a new shard when the current one is full
+		if( size >= shard_size )
+		{
+			result.files.push_back( next_name() );
+			result.first_keys.push_back( result.first_keys.empty() ? std::string() : item.first.front() );
+			size = 0;
+		}
+		
+		size += db.subtree_statistics( item ).bytes;
+	}
+	
+	if( result.files.empty() )
+	{
+		result.files.push_back( next_name() );
+		result.first_keys.push_back( std::string() );
+	}
+	
+	return result;
+}
+
+std::string load_shards( const std::string& directory, textdb& db )
+{
+	shard_manifest manifest;
+	if( !manifest.read( directory ) )
+		return "Invalid manifest in " + directory;
+	
+	// parse the shards in parallel
+	std::vector< textdb::item_batch > batches( manifest.files.size() );
+	std::vector< std::string > errors( manifest.files.size() );
+	std::atomic< size_t > next( 0 );
+	
+	auto parse_shards = [&]()
+	{
+		for( size_t i = next++; i < batches.size(); i = next++ )
+		{
+			input_file input( manifest.path( directory, i ) );
+			if( !input.is_open() )
+			{
+				errors[i] = input.error().empty() ? "Could not open " + manifest.path( directory, i ) : input.error();
+				continue;
+			}
+			
+			textdb::keys temp_keys({""});
+			db.parse( input, temp_keys, [&batch = batches[i]]( const textdb::keys& item_keys, textdb::values& item_values )
+			{
+				batch.emplace_back( item_keys, std::move( item_values ) );
+			} );
+			input.close();
+			errors[i] = input.error();
+		}
+	};
+	
+	std::vector< std::thread > threads;
+	size_t thread_count = std::min< size_t >( std::max( std::thread::hardware_concurrency(), 1u ), batches.size() );
+	for( size_t i = 0; i < thread_count; i++ )
+		threads.emplace_back( parse_shards );
+	for( auto& thread : threads )
+		thread.join();
+	
+	for( auto& error : errors )
+	{
+		if( !error.empty() )
+			return error;
+	}
+	
+	// the shards are ranges of keys in order, their items are added at the end
+	db.clear();
+	db.set_shards( manifest.first_keys );
+	for( auto& batch : batches )
+	{
+		for( auto& item : batch )
+			db.add( db.items().end(), std::move( item.first ), std::move( item.second ) );
+		
+		textdb::item_batch().swap( batch );
+	}
+	
+	db.mark_clean();
+	return std::string();
+}
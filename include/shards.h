@@ -0,0 +1,75 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+// Sharded collection header
+
+#ifndef TEXTDB_SHARDS
+#define TEXTDB_SHARDS
+
+#include <string>
+#include <vector>
+
+#include "textdb.h"
+
+/** A sharded collection is a directory with one file in the file format per
+ * range of top-level keys and a manifest, which lists the files and the
+ * first top-level key of each range:
+ * 
+ * text-db shards
+ * shard-0000<tab>
+ * shard-0001<tab>first key of shard 1
+ * ...
+ */
+class shard_manifest
+{
+	
+	public:
+		
+		/// Size of the shards of a new sharded collection in bytes
+		static const size_t default_shard_size = 8 << 20;
+		
+		/// File names of the shards
+		std::vector< std::string > files;
+		
+		/// First top-level key of each shard, the first one is empty
+		std::vector< std::string > first_keys;
+		
+		/// Checks if path is a directory with a manifest
+		static bool is_sharded( const std::string& path );
+		
+		/// Reads the manifest of a directory, \returns false if there is none or it is invalid
+		bool read( const std::string& directory );
+		
+		/// Writes the manifest to a directory, replaces the old manifest at once
+		bool write( const std::string& directory ) const;
+		
+		/// Splits the top-level items of db into shards of about shard_size bytes, names them other than taken
+		static shard_manifest split( const textdb& db, size_t shard_size, const std::vector< std::string >& taken = {} );
+		
+		/// Returns the path of shard i in directory
+		std::string path( const std::string& directory, size_t i ) const { return directory + "/" + files[i]; }
+		
+};
+
+/** Loads a sharded collection into db, the shards are read and parsed in
+ * parallel, db is cleared before and sharded like the collection after
+ * \returns an error message, empty on success
+ */
+std::string load_shards( const std::string& directory, textdb& db );
+
+#endif
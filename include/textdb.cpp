@@ -20,65 +20,765 @@
 
 #include "textdb.h"
 
-void textdb::print( std::ostream& output, bool color )
+#include <algorithm>
+
+std::atomic< uint64_t > textdb::_last_generation( 0 );
+
+void textdb::print( std::ostream& output, bool color, const print_options& projection ) const
+{
+	output_writer writer( output );
+	
+	// use the frozen layout if it is up to date
+	if( _frozen )
+		print_frozen( writer, *_frozen, _delimiter, resolve_colors( color ), 0, _frozen->size(), 1, projection );
+	else
+		print_items( writer, resolve_colors( color ), _items.begin(), _items.end(), 1, projection );
+}
+
+void textdb::print( std::ostream& output, bool color, const keys& item_keys, const print_options& projection ) const
 {
-	// print all items
-	for( auto item : _items )
+	output_writer writer( output );
+	size_t root_depth = std::max< size_t >( item_keys.size(), 1 );
+	
+	// use the frozen layout if it is up to date
+	if( _frozen )
+	{
+		auto range = _frozen->subtree( item_keys );
+		print_frozen( writer, *_frozen, _delimiter, resolve_colors( color ), range.first, range.second, root_depth, projection );
+	}
+	else
 	{
-		// determine correct escape codes for color
-		std::string color_key = color ? item.first.size() == 1 ? _colors.at("key") : _colors.at("subkey") : "";
-		std::string color_value = color ? item.first.size() == 1 ? _colors.at("value") : _colors.at("subvalue") : "";
-		std::string color_reset = color ? _colors.at("reset") : "";
+		auto range = subtree( item_keys );
+		print_items( writer, resolve_colors( color ), range.first, range.second, root_depth, projection );
+	}
+}
+
+void textdb::print( std::ostream& output, item_map::const_iterator first, item_map::const_iterator last ) const
+{
+	output_writer writer( output );
+	print_items( writer, color_codes(), first, last, 1, print_options() );
+}
+
+void textdb::print( std::ostream& output, const frozen_items& items, char delimiter )
+{
+	print( output, items, delimiter, 0, items.size() );
+}
+
+void textdb::print( std::ostream& output, const frozen_items& items, char delimiter, size_t first, size_t last )
+{
+	output_writer writer( output );
+	print_frozen( writer, items, delimiter, color_codes(), first, last, 1, print_options() );
+}
+
+textdb::color_codes textdb::resolve_colors( bool color ) const
+{
+	if( !color )
+		return color_codes();
+	
+	return { _colors.at("key"), _colors.at("subkey"), _colors.at("value"), _colors.at("subvalue"), _colors.at("reset") };
+}
+
+void textdb::print_items( output_writer& output, const color_codes& colors, item_map::const_iterator first, item_map::const_iterator last, size_t root_depth, const print_options& projection ) const
+{
+	for( auto item = first; item != last; )
+	{
+		size_t depth = item->first.size();
+		
+		// skip excluded subtrees
+		size_t level = ( depth > root_depth ) ? depth - root_depth : 0;
+		if( ( projection.max_depth > 0 && level >= projection.max_depth ) ||
+			( level == 1 && !projection.fields.empty() && projection.fields.count( item->first.back() ) == 0 ) )
+		{
+			item = subtree( item->first ).second;
+			continue;
+		}
 		
 		// padding
-		for( auto i = item.first.size(); i > 1; i-- )
-			output << _delimiter;
+		output.put( _delimiter, depth-1 );
 		
 		// key
-		output << color_key << item.first.back() << color_reset;
+		output.write( depth == 1 ? colors.key : colors.subkey );
+		output.write( item->first.back() );
+		output.write( colors.reset );
 		
 		// values
-		for( auto value : item.second )
-			output << _delimiter << color_value << value << color_reset;
+		for( auto& value : item->second )
+		{
+			output.put( _delimiter );
+			output.write( depth == 1 ? colors.value : colors.subvalue );
+			output.write( value );
+			output.write( colors.reset );
+		}
 		
-		output << std::endl;
+		output.put( '\n' );
+		item++;
 	}
-	
 }
 
-void textdb::print( std::ostream& output, bool color, const keys& item_keys )
+void textdb::print_frozen( output_writer& output, const frozen_items& items, char delimiter, const color_codes& colors, size_t first, size_t last, size_t root_depth, const print_options& projection )
 {
-	// iterate over all items
-	for( auto item : _items )
+	// linear sweep over the item array
+	for( size_t i = first; i < last; )
 	{
-		if( !compare_vectors( item.first, item_keys ) )
-			continue;
+		auto& item = items.at(i);
 		
-		// determine correct escape codes for color
-		std::string color_key = color ? item.first.size() == 1 ? _colors.at("key") : _colors.at("subkey") : "";
-		std::string color_value = color ? item.first.size() == 1 ? _colors.at("value") : _colors.at("subvalue") : "";
-		std::string color_reset = color ? _colors.at("reset") : "";
+		// skip excluded subtrees
+		size_t level = ( item.depth > root_depth ) ? item.depth - root_depth : 0;
+		if( ( projection.max_depth > 0 && level >= projection.max_depth ) ||
+			( level == 1 && !projection.fields.empty() && projection.fields.count( std::string( items.key(i) ) ) == 0 ) )
+		{
+			i = item.subtree_end;
+			continue;
+		}
 		
 		// padding
-		for( auto i = item.first.size(); i > 1; i-- )
-			output << _delimiter;
+		output.put( delimiter, item.depth-1 );
 		
 		// key
-		output << color_key << item.first.back() << color_reset;
+		output.write( item.depth == 1 ? colors.key : colors.subkey );
+		output.write( items.key(i) );
+		output.write( colors.reset );
 		
 		// values
-		for( auto value : item.second )
-			output << _delimiter << color_value << value << color_reset;
+		for( size_t v = item.values_begin; v < item.values_end; v++ )
+		{
+			output.put( delimiter );
+			output.write( item.depth == 1 ? colors.value : colors.subvalue );
+			output.write( items.value(v) );
+			output.write( colors.reset );
+		}
 		
-		output << std::endl;
+		output.put( '\n' );
+		i++;
 	}
+}
+
+std::pair< textdb::item_map::const_iterator, textdb::item_map::const_iterator > textdb::subtree( const keys& item_keys ) const
+{
+	if( item_keys.empty() )
+		return { _items.begin(), _items.end() };
 	
+	// every subitem is less than the path with '\0' appended to the last element
+	keys end_keys = item_keys;
+	end_keys.back().push_back( '\0' );
+	
+	return { _items.lower_bound( item_keys ), _items.lower_bound( end_keys ) };
 }
 
-void textdb::load( std::istream& input )
+std::pair< textdb::item_map::const_iterator, bool > textdb::add( const keys& item_keys, const values& item_values )
+{
+	auto result = _items.try_emplace( item_keys, item_values );
+	if( result.second )
+		on_insert( result.first );
+	
+	return result;
+}
+
+textdb::item_map::const_iterator textdb::add( item_map::const_iterator hint, keys item_keys, values item_values )
+{
+	size_t size = _items.size();
+	auto item = _items.emplace_hint( hint, std::move( item_keys ), std::move( item_values ) );
+	if( _items.size() != size )
+		on_insert( item );
+	
+	return item;
+}
+
+void textdb::assign( const keys& item_keys, const values& item_values )
+{
+	auto item = _items.find( item_keys );
+	if( item == _items.end() )
+	{
+		on_insert( _items.emplace( item_keys, item_values ).first );
+		return;
+	}
+	
+	on_values_changing( item );
+	item->second = item_values;
+	on_values_changed( item );
+}
+
+bool textdb::add_value( item_map::const_iterator item, const std::string& value )
+{
+	if( item->second.contains( value ) )
+		return false;
+	
+	on_values_changing( item );
+	to_mutable( item )->second.push_back( value );
+	on_values_changed( item );
+	return true;
+}
+
+bool textdb::erase_value( item_map::const_iterator item, const std::string& value )
+{
+	if( !item->second.contains( value ) )
+		return false;
+	
+	on_values_changing( item );
+	to_mutable( item )->second.erase( value );
+	on_values_changed( item );
+	return true;
+}
+
+size_t textdb::erase_values( item_map::const_iterator item, const std::function< bool( const std::string& ) >& predicate )
+{
+	// nothing to delete: no new generation, cached results stay valid
+	if( std::none_of( item->second.begin(), item->second.end(), predicate ) )
+		return 0;
+	
+	on_values_changing( item );
+	size_t erased = to_mutable( item )->second.erase_if( predicate );
+	on_values_changed( item );
+	
+	return erased;
+}
+
+textdb::item_map::const_iterator textdb::erase( item_map::const_iterator item )
+{
+	on_erase( item );
+	return _items.erase( item );
+}
+
+textdb::item_map::const_iterator textdb::erase( item_map::const_iterator first, item_map::const_iterator last )
+{
+	for( auto item = first; item != last; item++ )
+		on_erase( item );
+	
+	return _items.erase( first, last );
+}
+
+textdb::statistics textdb::subtree_statistics( const keys& item_keys ) const
+{
+	// top-level items are counted all the time
+	if( item_keys.size() == 1 )
+	{
+		auto item = _items.find( item_keys );
+		return ( item == _items.end() ) ? statistics() : subtree_statistics( *item );
+	}
+	
+	statistics result;
+	auto range = subtree( item_keys );
+	for( auto item = range.first; item != range.second; item++ )
+		add_statistics( result, *item, 1 );
+	
+	return result;
+}
+
+textdb::statistics textdb::subtree_statistics( const item_map::value_type& item ) const
+{
+	if( item.first.size() != 1 )
+		return subtree_statistics( item.first );
+	
+	auto top = _top_level.find( &item );
+	return ( top == _top_level.end() ) ? statistics() : top->second;
+}
+
+void textdb::add_statistics( statistics& s, const item_map::value_type& item, int sign )
 {
+	// the line in the file: indentation, key, delimiter + value for each value, newline
+	size_t bytes = item.first.size() + item.first.back().size() + item.second.size() + item.second.bytes();
 	
+	s.items += sign;
+	s.values += sign * item.second.size();
+	s.bytes += sign * bytes;
+}
+
+void textdb::count( const item_map::value_type& item, int sign )
+{
+	add_statistics( _total, item, sign );
+	if( item.first.size() == 1 )
+		_top_level_items += sign;
+	
+	// look up the top-level item when the top-level key changes or the top-level item may have been added
+	if( !_last_top_level_valid || _last_top_level != item.first.front() || ( !_last_top_level_statistics && item.first.size() == 1 ) )
+	{
+		_last_top_level = item.first.front();
+		_last_top_level_valid = true;
+		_last_top_level_statistics = nullptr;
+		
+		// items are counted in their map nodes, a top-level item is its own top-level node
+		const item_map::value_type* top = &item;
+		_top_level_keys.front() = item.first.front();
+		if( item.first.size() != 1 )
+		{
+			auto found = _items.find( _top_level_keys );
+			top = ( found == _items.end() ) ? nullptr : &*found;
+		}
+		
+		if( top && sign < 0 )
+		{
+			// an item that is deleted along with its top-level item has no entry anymore
+			auto entry = _top_level.find( top );
+			if( entry != _top_level.end() )
+				_last_top_level_statistics = &entry->second;
+		}
+		else if( top )
+		{
+			auto entry = _top_level.try_emplace( top );
+			_last_top_level_statistics = &entry.first->second;
+			
+			// a top-level item added after its subitems, count them now
+			if( entry.second && top == &item )
+			{
+				for( auto subitem = _items.upper_bound( _top_level_keys ); subitem != _items.end() && subitem->first.front() == item.first.front(); subitem++ )
+					add_statistics( entry.first->second, *subitem, 1 );
+			}
+		}
+		
+		if( !_shards.empty() )
+			_last_shard = shard_of( item.first.front() );
+	}
+	
+	if( !_shards.empty() )
+	{
+		_dirty[_last_shard] = true;
+		_dirty_since[_last_shard] = _generation;
+	}
+	
+	if( _last_top_level_statistics )
+		add_statistics( *_last_top_level_statistics, item, sign );
+}
+
+void textdb::set_shards( const std::vector< std::string >& first_keys )
+{
+	_shards = first_keys;
+	_dirty.assign( _shards.size(), true );
+	_dirty_since.assign( _shards.size(), 0 );
+	_last_top_level_valid = false;
+}
+
+size_t textdb::shard_of( const std::string& top_level_key ) const
+{
+	// the last shard starting before or at the key
+	auto shard = std::upper_bound( _shards.begin(), _shards.end(), top_level_key );
+	return ( shard == _shards.begin() ) ? 0 : shard - _shards.begin() - 1;
+}
+
+std::vector< size_t > textdb::dirty_shards() const
+{
+	std::vector< size_t > result;
+	for( size_t i = 0; i < _dirty.size(); i++ )
+	{
+		if( _dirty[i] )
+			result.push_back( i );
+	}
+	
+	return result;
+}
+
+void textdb::mark_clean()
+{
+	_dirty.assign( _shards.size(), false );
+}
+
+void textdb::mark_clean( size_t shard, uint64_t generation )
+{
+	// a change after the snapshot leaves a generation at least as new as the snapshot's
+	if( shard < _dirty.size() && _dirty_since[shard] < generation )
+		_dirty[shard] = false;
+}
+
+void textdb::on_insert( item_map::const_iterator position )
+{
+	auto& item = *position;
+	if( _dedup )
+		share_values( position );
+	count( item, 1 );
+	if( _segments_counted )
+		count_segments( item, 1 );
+	if( _postings_built )
+		post( item, 1 );
+	if( _paths_built )
+		_paths.emplace( hash( item.first ), position );
+	index( item, 1 );
+	changed();
+	if( _listener )
+		_listener( change_type::set, &item );
+}
+
+void textdb::on_erase( item_map::const_iterator position )
+{
+	auto& item = *position;
+	if( _listener )
+		_listener( change_type::erase, &item );
+	count( item, -1 );
+	if( item.first.size() == 1 )
+	{
+		// the node of the item can be reused by another top-level item
+		_top_level.erase( &item );
+		_last_top_level_valid = false;
+	}
+	if( _segments_counted )
+		count_segments( item, -1 );
+	if( _postings_built )
+		post( item, -1 );
+	if( _paths_built )
+		erase_path( position );
+	index( item, -1 );
+	changed();
+}
+
+void textdb::on_values_changing( item_map::const_iterator position )
+{
+	auto& item = *position;
+	count( item, -1 );
+	index( item, -1 );
+}
+
+void textdb::on_values_changed( item_map::const_iterator position )
+{
+	auto& item = *position;
+	if( _dedup )
+		share_values( position );
+	count( item, 1 );
+	index( item, 1 );
+	changed();
+	if( _listener )
+		_listener( change_type::set, &item );
+}
+
+void textdb::share_values( item_map::const_iterator item )
+{
+	// single values are kept inline, there is nothing to share
+	if( !item->second.shareable() )
+		return;
+	
+	// replace the values with an equal shared list, or share them
+	size_t h = item->second.hash();
+	auto range = _shared_values.equal_range( h );
+	for( auto shared = range.first; shared != range.second; shared++ )
+	{
+		if( shared->second == item->second )
+		{
+			to_mutable( item )->second = shared->second;
+			return;
+		}
+	}
+	
+	_shared_values.emplace( h, item->second );
+}
+
+void textdb::set_dedup( bool dedup )
+{
+	_dedup = dedup;
+	if( !_dedup )
+	{
+		_shared_values.clear();
+		return;
+	}
+	
+	for( auto item = _items.begin(); item != _items.end(); item++ )
+		share_values( item );
+}
+
+size_t textdb::release_shared_values()
+{
+	size_t released = 0;
+	for( auto shared = _shared_values.begin(); shared != _shared_values.end(); )
+	{
+		// only used by _shared_values
+		if( shared->second.use_count() == 1 )
+		{
+			shared = _shared_values.erase( shared );
+			released++;
+		}
+		else
+			shared++;
+	}
+	
+	return released;
+}
+
+void textdb::count_segments( const item_map::value_type& item, int sign ) const
+{
+	if( _segments.size() < item.first.size() )
+	{
+		_segments.resize( item.first.size() );
+		_last_segments.resize( item.first.size(), nullptr );
+	}
+	
+	for( size_t depth = 0; depth < item.first.size(); depth++ )
+	{
+		auto& last = _last_segments[depth];
+		if( !last || last->first != item.first[depth] )
+			last = &*_segments[depth].try_emplace( item.first[depth], 0 ).first;
+		
+		last->second += sign;
+		if( last->second == 0 )
+		{
+			_segments[depth].erase( _segments[depth].find( last->first ) );
+			last = nullptr;
+		}
+	}
+}
+
+const textdb::segment_map& textdb::segments( size_t depth ) const
+{
+	if( !_segments_counted )
+	{
+		std::lock_guard< std::mutex > lock( _lazy_mutex );
+		if( !_segments_counted )
+		{
+			for( auto& item : _items )
+				count_segments( item, 1 );
+			_segments_counted = true;
+		}
+	}
+	
+	static const segment_map empty;
+	return ( depth < _segments.size() ) ? _segments[depth] : empty;
+}
+
+textdb::item_map::const_iterator textdb::find( const keys& item_keys ) const
+{
+	if( !_paths_built )
+	{
+		std::lock_guard< std::mutex > lock( _lazy_mutex );
+		if( !_paths_built )
+		{
+			for( auto item = _items.begin(); item != _items.end(); item++ )
+				_paths.emplace( hash( item->first ), item );
+			_paths_built = true;
+		}
+	}
+	
+	auto range = _paths.equal_range( hash( item_keys ) );
+	for( auto path = range.first; path != range.second; path++ )
+	{
+		if( path->second->first == item_keys )
+			return path->second;
+	}
+	
+	return _items.end();
+}
+
+void textdb::erase_path( item_map::const_iterator item )
+{
+	auto range = _paths.equal_range( hash( item->first ) );
+	for( auto path = range.first; path != range.second; path++ )
+	{
+		if( path->second == item )
+		{
+			_paths.erase( path );
+			return;
+		}
+	}
+}
+
+void textdb::post( const item_map::value_type& item, int sign ) const
+{
+	if( sign > 0 )
+	{
+		_postings[ item.first.back() ].insert( &item );
+		return;
+	}
+	
+	auto list = _postings.find( item.first.back() );
+	list->second.erase( &item );
+	if( list->second.empty() )
+		_postings.erase( list );
+}
+
+const textdb::posting_list& textdb::postings( const std::string& segment ) const
+{
+	if( !_postings_built )
+	{
+		std::lock_guard< std::mutex > lock( _lazy_mutex );
+		if( !_postings_built )
+		{
+			for( auto& item : _items )
+				post( item, 1 );
+			_postings_built = true;
+		}
+	}
+	
+	static const posting_list empty;
+	auto list = _postings.find( segment );
+	return ( list != _postings.end() ) ? list->second : empty;
+}
+
+void textdb::index( const item_map::value_type& item, int sign )
+{
+	if( _numeric_indexes.empty() )
+		return;
+	
+	auto i = _numeric_indexes.find( item.first.back() );
+	if( i == _numeric_indexes.end() )
+		return;
+	
+	for( auto& value : item.second )
+	{
+		double number;
+		if( !value_predicate::to_number( value, number ) )
+			continue;
+		
+		if( sign > 0 )
+			i->second.emplace( number, &item );
+		else
+		{
+			// remove one entry per value, an item can have the same number twice (e.g. "1" and "1.0")
+			auto range = i->second.equal_range( number );
+			for( auto entry = range.first; entry != range.second; entry++ )
+				if( entry->second == &item )
+				{
+					i->second.erase( entry );
+					break;
+				}
+		}
+	}
+}
+
+bool textdb::create_index( const std::string& segment )
+{
+	auto i = _numeric_indexes.try_emplace( segment );
+	if( !i.second )
+		return false;
+	
+	for( auto& item : _items )
+		if( item.first.back() == segment )
+			index( item, 1 );
+	
+	return true;
+}
+
+bool textdb::drop_index( const std::string& segment )
+{
+	return _numeric_indexes.erase( segment ) != 0;
+}
+
+std::vector< std::string > textdb::indexes() const
+{
+	std::vector< std::string > result;
+	for( auto& i : _numeric_indexes )
+		result.push_back( i.first );
+	
+	std::sort( result.begin(), result.end() );
+	return result;
+}
+
+void textdb::find_range( const std::string& segment, const value_predicate& predicate, const std::function< void( const item_map::value_type& ) >& found ) const
+{
+	auto i = _numeric_indexes.find( segment );
+	if( i == _numeric_indexes.end() )
+		return;
+	
+	auto entry = predicate.low_inclusive() ? i->second.lower_bound( predicate.low() ) : i->second.upper_bound( predicate.low() );
+	for( ; entry != i->second.end() && predicate.matches( entry->first ); entry++ )
+		found( *entry->second );
+}
+
+void textdb::merge( item_batch& batch, bool replace )
+{
+	// sort the batch, for duplicate items the first one is kept like in load()
+	std::stable_sort( batch.begin(), batch.end(), []( const item_batch::value_type& a, const item_batch::value_type& b ){ return a.first < b.first; } );
+	batch.erase( std::unique( batch.begin(), batch.end(), []( const item_batch::value_type& a, const item_batch::value_type& b ){ return a.first == b.first; } ), batch.end() );
+	
+	// merge both sorted sequences, position only moves forward
+	auto position = _items.cbegin();
+	keys replaced;
+	for( auto b = batch.begin(); b != batch.end(); b++ )
+	{
+		// replace: delete the existing subtree of each top-level key once
+		if( replace && ( replaced.empty() || b->first.front() != replaced.front() ) )
+		{
+			replaced = keys({ b->first.front() });
+			auto range = subtree( replaced );
+			position = erase( range.first, range.second );
+		}
+		
+		// find the position of the item, walk short distances, search otherwise
+		for( int steps = 0; position != _items.end() && position->first < b->first; steps++, position++ )
+		{
+			if( steps == 16 )
+			{
+				position = _items.lower_bound( b->first );
+				break;
+			}
+		}
+		
+		// existing item: add missing values
+		if( position != _items.end() && position->first == b->first )
+		{
+			for( auto& value : b->second )
+				add_value( position, value );
+		}
+		else
+			position = add( position, std::move( b->first ), std::move( b->second ) );
+	}
+}
+
+void textdb::clear()
+{
+	_dirty_since.assign( _shards.size(), _generation );
+	changed();
+	_items.clear();
+	_total = statistics();
+	_top_level_items = 0;
+	_top_level.clear();
+	_last_top_level_valid = false;
+	_dirty.assign( _shards.size(), true );
+	_segments.clear();
+	_last_segments.clear();
+	_postings.clear();
+	_paths.clear();
+	_shared_values.clear();
+	
+	// keep the index definitions
+	for( auto& i : _numeric_indexes )
+		i.second.clear();
+	
+	if( _listener )
+		_listener( change_type::clear, nullptr );
+}
+
+void textdb::freeze()
+{
+	auto result = std::make_shared< frozen_items >();
+	
+	const keys* previous = nullptr;
+	for( auto& item : _items )
+	{
+		// every subitem has to follow its parent, otherwise the layout can't represent the items
+		size_t depth = item.first.size();
+		if( depth > 1 && ( !previous || previous->size()+1 < depth || !std::equal( item.first.begin(), item.first.end()-1, previous->begin() ) ) )
+		{
+			_frozen.reset();
+			return;
+		}
+		
+		result->push_back( depth, item.first.back(), item.second );
+		previous = &item.first;
+	}
+	
+	result->finish();
+	_frozen = result;
+}
+
+std::shared_ptr< const frozen_items > textdb::snapshot()
+{
+	if( !_frozen )
+		freeze();
+	
+	return _frozen;
+}
+
+void textdb::load( std::istream& input )
+{
 	keys temp_keys({""});
+	load( input, temp_keys );
+}
+
+void textdb::load( std::istream& input, keys& temp_keys )
+{
+	// files are usually sorted, then every item is inserted at the end in constant time
+	parse( input, temp_keys, [this]( const keys& item_keys, values& item_values )
+	{
+		add( _items.end(), item_keys, std::move( item_values ) );
+	} );
+}
+
+void textdb::parse( std::istream& input, keys& temp_keys, const std::function< void( const keys&, values& ) >& item ) const
+{
 	
 	// iterate over file
 	for( std::string line; std::getline( input, line, '\n' ); )
@@ -98,13 +798,7 @@ void textdb::load( std::istream& input )
 		depth = count_char_at_front( line, _delimiter );
 		
 		// remove leading delimiters from line
-		while( 1 )
-		{
-			if( line.front() == _delimiter )
-				line.erase( line.begin() );
-			else
-				break;
-		}
+		line.erase( 0, depth );
 		
 		// split line: last element of the key + values
 		string_to_vector( line, line_parts, _delimiter );
@@ -127,14 +821,14 @@ void textdb::load( std::istream& input )
 				temp_keys.back() = item_key_last;
 			
 			//item_keys = temp_keys;
-			_items.emplace( temp_keys, item_values );
+			item( temp_keys, item_values );
 		}
 		
 		// new item is child of previous item
 		else if( depth == temp_keys.size() )
 		{
 			temp_keys.push_back( item_key_last );
-			_items.emplace( temp_keys, item_values );
+			item( temp_keys, item_values );
 		}
 		
 		// new item is somewhere above previous item
@@ -142,79 +836,219 @@ void textdb::load( std::istream& input )
 		{
 			temp_keys.erase( temp_keys.begin()+depth, temp_keys.end() );
 			temp_keys.push_back( item_key_last );
-			_items.emplace( temp_keys, item_values );
+			item( temp_keys, item_values );
 		}
 		
 	}
 		
 }
 
-void textdb::to_graphviz( std::ostream& output )
+void textdb::load_tsv( std::istream& input )
 {
+	// missing parents are added last, a row for the parent later in the file keeps its values
+	std::vector< keys > parents;
+	parse_tsv( input, [this]( const keys& item_keys, values& item_values )
+	{
+		add( _items.end(), item_keys, std::move( item_values ) );
+	}, [&parents]( const keys& parent_keys )
+	{
+		parents.push_back( parent_keys );
+	} );
 	
-	output << "digraph {\n";
-	
-	// graph state
-	bool in_subgraph = false;
-	std::string item_name = "";
-	// size_t item_number = 0;
+	for( auto& parent_keys : parents )
+		add( parent_keys, values() );
+}
+
+void textdb::parse_tsv( std::istream& input, const std::function< void( const keys&, values& ) >& item, const std::function< void( const keys& ) >& parent ) const
+{
+	// path of the previous item
+	keys previous;
 	
-	// iterate over all items
-	for( auto item : _items )
+	for( std::string line; std::getline( input, line, '\n' ); )
 	{
+		keys item_keys;
+		values item_values;
 		
-		// if top level item
-		if( item.first.size() == 1 )
+		// key elements are terminated by a tab, the first empty field separates the values
+		size_t begin = 0;
+		while( begin < line.size() && line[begin] != '\t' )
 		{
+			size_t end = line.find( '\t', begin );
+			if( end == std::string::npos )
+				end = line.size();
 			
-			if( in_subgraph )
-				output << "\t}\n";
-			
-			// TODO! " in item name is not handled
-			item_name = item.first.back();
-			output << "\tsubgraph \"" << item_name << "\" {\n";
-			output << "\t\t\"" << item_name << "\";\n";
-			in_subgraph = true;
-			
+			item_keys.emplace_back( line, begin, end-begin );
+			begin = end+1;
 		}
-		else
+		
+		// values, each preceded by a tab
+		while( begin < line.size() )
 		{
-			output << "\t\t";
-			bool first = true;
+			size_t end = line.find( '\t', begin+1 );
+			if( end == std::string::npos )
+				end = line.size();
 			
-			// iterate over item path
-			for( auto element : item.first )
+			item_values.push_back( line.substr( begin+1, end-begin-1 ) );
+			begin = end;
+		}
+		
+		if( item_keys.empty() )
+			continue;
+		
+		// rows are complete paths, add parents that are not part of the file
+		size_t common = 0;
+		while( common < previous.size() && common+1 < item_keys.size() && previous[common] == item_keys[common] )
+			common++;
+		
+		for( size_t depth = common+1; depth < item_keys.size(); depth++ )
+		{
+			keys parent_keys( item_keys.begin(), item_keys.begin()+depth );
+			if( parent )
 			{
-				if( !first )
-					output << " -> ";
-				else
-					first = false;
-				
-				output << "\"" << element << "\"";
+				parent( parent_keys );
+				continue;
 			}
 			
-			output << ";\n";
+			values no_values;
+			item( parent_keys, no_values );
 		}
 		
+		item( item_keys, item_values );
+		previous = std::move( item_keys );
 	}
+}
+
+void textdb::to_graphviz( std::ostream& output, size_t max_depth, size_t max_children ) const
+{
+	output_writer writer( output );
+	writer.write( "digraph {\n" );
 	
+	// node IDs are the position in the output, labels are escaped
+	size_t next_id = 0;
+	auto write_node = [&writer]( size_t id, std::string_view label )
+	{
+		writer.write( "\tn" );
+		writer.write( std::to_string( id ) );
+		writer.write( " [label=\"" );
+		for( char c : label )
+		{
+			if( c == '"' || c == '\\' )
+				writer.put( '\\' );
+			writer.put( c );
+		}
+		writer.write( "\"];\n" );
+	};
+	auto write_edge = [&writer]( size_t from, size_t to )
+	{
+		writer.write( "\tn" );
+		writer.write( std::to_string( from ) );
+		writer.write( " -> n" );
+		writer.write( std::to_string( to ) );
+		writer.write( ";\n" );
+	};
 	
-	if( in_subgraph )
-		output << "\t}\n";
-		
-	output << "}\n";
+	// the current path: node ID, number of shown and omitted children per depth
+	struct parent
+	{
+		size_t id, children, omitted;
+	};
+	std::vector< parent > path({ { SIZE_MAX, 0, 0 } });
 	
+	// summary node for omitted children
+	auto close = [&]( size_t depth )
+	{
+		while( path.size() > depth )
+		{
+			parent& p = path.back();
+			if( p.omitted > 0 )
+			{
+				size_t id = next_id++;
+				write_node( id, "+" + std::to_string( p.omitted ) + " more" );
+				if( p.id != SIZE_MAX )
+					write_edge( p.id, id );
+			}
+			path.pop_back();
+		}
+	};
+	
+	for( auto item = _items.begin(); item != _items.end(); )
+	{
+		size_t depth = item->first.size();
+		close( depth );
+		parent& p = path.back();
+		
+		// skip the subtree if the depth or fan-out limit is reached
+		if( path.size() != depth || ( max_depth > 0 && depth > max_depth ) || ( max_children > 0 && p.children >= max_children ) )
+		{
+			if( path.size() == depth )
+				p.omitted++;
+			item = subtree( item->first ).second;
+			continue;
+		}
+		
+		size_t id = next_id++;
+		write_node( id, item->first.back() );
+		if( p.id != SIZE_MAX )
+			write_edge( p.id, id );
+		p.children++;
+		
+		path.push_back( { id, 0, 0 } );
+		item++;
+	}
 	
+	close( 0 );
+	writer.write( "}\n" );
 }
 
-void textdb::to_tsv( std::ostream& output )
+void textdb::to_tsv( std::ostream& output ) const
 {
+	// use the frozen layout if it is up to date
+	if( _frozen )
+	{
+		to_tsv( output, *_frozen );
+		return;
+	}
+	
+	output_writer writer( output );
 	for( auto& i : _items )
 	{
 		for( auto& k : i.first )
-			output << k << "\t";
+		{
+			writer.write( k );
+			writer.put( '\t' );
+		}
 		for( auto& v : i.second )
-			output << "\t" << v;
-		output << std::endl;
+		{
+			writer.put( '\t' );
+			writer.write( v );
+		}
+		writer.put( '\n' );
+	}
+}
+
+void textdb::to_tsv( std::ostream& output, const frozen_items& items )
+{
+	output_writer writer( output );
+	
+	// key elements of the current item
+	std::vector< std::string_view > path;
+	
+	for( size_t i = 0; i < items.size(); i++ )
+	{
+		auto& item = items.at(i);
+		path.resize( item.depth - 1 );
+		path.push_back( items.key(i) );
+		
+		for( auto& k : path )
+		{
+			writer.write( k );
+			writer.put( '\t' );
+		}
+		for( size_t v = item.values_begin; v < item.values_end; v++ )
+		{
+			writer.put( '\t' );
+			writer.write( items.value(v) );
+		}
+		writer.put( '\n' );
 	}
 }
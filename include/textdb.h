@@ -24,12 +24,24 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <string_view>
+#include <cstdint>
 #include <sstream>
 #include <utility>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
 #include <set>
 #include <memory>
 #include <regex>
+#include <functional>
+#include <atomic>
+#include <mutex>
+
+#include "values.h"
+#include "frozen.h"
+#include "writer.h"
+#include "predicate.h"
 
 /// This class represents a database / file
 class textdb
@@ -47,23 +59,35 @@ class textdb
 		 * checks only the first v2.size() elements from v1
 		 * \returns false if v2.size() > v1.size() or different elements in v2 and v1
 		 */
-		static bool compare_vectors( std::vector< std::string > v1, std::vector< std::string > v2 );
+		static bool compare_vectors( const std::vector< std::string >& v1, const std::vector< std::string >& v2 );
 
 		/** Compare vectors by element
 		 * \returns false if v1.size() != v2.size() or different elements in v2 and v1
 		 */
-		static bool compare_vectors_exact( std::vector< std::string > v1, std::vector< std::string > v2 );
+		static bool compare_vectors_exact( const std::vector< std::string >& v1, const std::vector< std::string >& v2 );
 
 		/** Compare vectors by element, treats elements of v2 as regex,
 		 * checks only the first v2.size() elements from v1
 		 * \returns false if v2.size() > v1.size() or v2 doesn't describe v1
 		 */
-		static bool compare_vectors_regex( std::vector< std::string > v1, std::vector< std::string > v2 );
+		static bool compare_vectors_regex( const std::vector< std::string >& v1, const std::vector< std::string >& v2 );
 
 		/** Compare vectors by element, treats elements of v2 as regex
 		 * \returns false if v1.size() != v2.size() or v2 doesn't describe v1
 		 */
-		static bool compare_vectors_regex_exact( std::vector< std::string > v1, std::vector< std::string > v2 );
+		static bool compare_vectors_regex_exact( const std::vector< std::string >& v1, const std::vector< std::string >& v2 );
+		
+		/// Checks if a string contains no regex special characters, i.e. a regex match is equal to a string comparison
+		static bool is_literal( const std::string& term );
+		
+		/// Checks if all elements of a vector are literal
+		static bool is_literal( const std::vector< std::string >& terms );
+		
+		/// FNV-1a hash, stable across runs and platforms, pass a previous result as h to continue hashing
+		static uint64_t hash( std::string_view data, uint64_t h = 14695981039346656037ULL );
+		
+		/// Hash of a path, the elements are hashed one after another with hash()
+		static uint64_t hash( const std::vector< std::string >& path );
 	
 	public:
 		
@@ -71,32 +95,409 @@ class textdb
 		typedef std::vector< std::string > keys;
 		
 		/// The values type, holds values associated with a single key
-		//typedef std::set< std::string > values;
-		typedef std::vector< std::string > values;
+		typedef value_list values;
+		
+		/// The map type holding all items
+		typedef std::map< keys, values > item_map;
+		
+		/// Items that are not (yet) part of a database
+		typedef std::vector< std::pair< keys, values > > item_batch;
+		
+		/// Size of a collection or a subtree
+		struct statistics
+		{
+			/// Number of items
+			size_t items = 0;
+			/// Number of values
+			size_t values = 0;
+			/// Size in the file format in bytes
+			size_t bytes = 0;
+		};
+		
+		/** Returns a reference to the _items map, changes have to be made with
+		 * the modification functions below
+		 */
+		const item_map& items() const { return _items; }
 		
-		/// Returns a reference to the _items map
-		std::map< keys, values >& items() { return _items; }
 		/// Returns _delimiter
 		char delimiter() { return _delimiter; }
 		
+		/** Returns the item with exactly item_keys, end() if there is none.
+		 * Uses a hash index of all paths, which is built on the first call
+		 * and kept up to date with every change after that.
+		 */
+		item_map::const_iterator find( const keys& item_keys ) const;
+		
+		/** Returns the range of items that start with item_keys, i.e. the item itself and all subitems.
+		 * Because _items is ordered, a subtree is always a contiguous range.
+		 */
+		std::pair< item_map::const_iterator, item_map::const_iterator > subtree( const keys& item_keys ) const;
+		
+		// modification functions, all changes to _items go through these
+		
+		/** Adds an item if it doesn't exist
+		 * \returns an iterator to the item and true if it was added
+		 */
+		std::pair< item_map::const_iterator, bool > add( const keys& item_keys, const values& item_values = values() );
+		
+		/// Adds an item if it doesn't exist, the item is inserted as close as possible before hint
+		item_map::const_iterator add( item_map::const_iterator hint, keys item_keys, values item_values );
+		
+		/// Adds an item or replaces the values of an existing item
+		void assign( const keys& item_keys, const values& item_values );
+		
+		/** Adds a value to an item if it doesn't have this value
+		 * \returns true if the value was added
+		 */
+		bool add_value( item_map::const_iterator item, const std::string& value );
+		
+		/** Deletes a value from an item, O(1) amortized for items with many values
+		 * \returns true if the item had this value
+		 */
+		bool erase_value( item_map::const_iterator item, const std::string& value );
+		
+		/** Deletes all values of an item for which predicate returns true
+		 * \returns the number of deleted values
+		 */
+		size_t erase_values( item_map::const_iterator item, const std::function< bool( const std::string& ) >& predicate );
+		
+		/// Deletes an item, \returns the iterator following the deleted item
+		item_map::const_iterator erase( item_map::const_iterator item );
+		
+		/// Deletes a range of items, \returns last
+		item_map::const_iterator erase( item_map::const_iterator first, item_map::const_iterator last );
+		
+		/** Merges a batch of items into the database: the batch is sorted and merged
+		 * in a single pass, values of existing items are added to
+		 * \arg replace replace the subtrees of the top-level items in batch instead
+		 */
+		void merge( item_batch& batch, bool replace );
+		
+		/// Deletes all items and resets the counters and indexes
+		void clear();
+		
+		/// Kinds of changes reported to the change listener
+		enum class change_type { set, erase, clear };
+		
+		/** Called after an item has been added or its values have changed (set),
+		 * before an item is deleted (erase) and after all items have been deleted
+		 * (clear, the item is nullptr)
+		 */
+		typedef std::function< void( change_type, const item_map::value_type* ) > change_listener;
+		
+		/// Sets the function that is told about every change of the items, nullptr to remove it
+		void set_change_listener( change_listener listener ) { _listener = std::move( listener ); }
+		
+		/** Turns deduplication of value lists on or off: while it is on, items with
+		 * equal values share a single list, which is copied when one of them changes.
+		 * Only lists of more than one value are shared, single values are inline.
+		 */
+		void set_dedup( bool dedup );
+		
+		/// Checks if value lists are deduplicated
+		bool dedup() const { return _dedup; }
+		
+		/** Forgets the shared value lists that are not used by any item anymore
+		 * \returns the number of released lists
+		 */
+		size_t release_shared_values();
+		
+		/** Builds the frozen (read optimized) layout of all items, which is used
+		 * for printing until the next change. It is a second copy of the items,
+		 * loading doesn't build it, snapshot() does when it is needed.
+		 */
+		void freeze();
+		
+		/// Checks if the frozen layout is up to date
+		bool frozen() const { return (bool)_frozen; }
+		
+		/** Returns a read only copy of all items that stays valid while the items change,
+		 * builds the frozen layout if it is not up to date (a full copy, O(n))
+		 * \returns nullptr if the items can't be represented by the frozen layout
+		 */
+		std::shared_ptr< const frozen_items > snapshot();
+		
+		/// Returns the statistics of all items, kept up to date with every change
+		const statistics& total() const { return _total; }
+		
+		/// Returns the number of top-level items, kept up to date with every change
+		size_t top_level_items() const { return _top_level_items; }
+		
+		/** Splits the items into shards by ranges of top-level keys: shard i holds the top-level
+		 * keys from first_keys[i] up to first_keys[i+1], first_keys[0] has to be empty.
+		 * All shards are dirty afterwards, no shards if first_keys is empty.
+		 */
+		void set_shards( const std::vector< std::string >& first_keys );
+		
+		/// Returns the first top-level key of each shard
+		const std::vector< std::string >& shards() const { return _shards; }
+		
+		/// Returns the shard holding a top-level key
+		size_t shard_of( const std::string& top_level_key ) const;
+		
+		/// Returns the shards changed since they were last marked as unchanged
+		std::vector< size_t > dirty_shards() const;
+		
+		/// Marks all shards as unchanged, e.g. after they have been loaded
+		void mark_clean();
+		
+		/** Marks a shard as unchanged if it didn't change since generation (see generation()),
+		 * e.g. after a snapshot of that generation has been saved
+		 */
+		void mark_clean( size_t shard, uint64_t generation );
+		
+		/// Returns the statistics of an item and its subitems
+		statistics subtree_statistics( const keys& item_keys ) const;
+		
+		/// Returns the statistics of an item of the database and its subitems, in constant time for top-level items
+		statistics subtree_statistics( const item_map::value_type& item ) const;
+		
+		/** Returns the generation of the items, it changes with every change to
+		 * the items and is unique across all textdb objects
+		 */
+		uint64_t generation() const { return _generation; }
+		
+		/// Restricts which subitems print() outputs
+		struct print_options
+		{
+			print_options() : max_depth( 0 ) {}
+			
+			/// Print only this many levels of each printed item, 0 for no limit
+			size_t max_depth;
+			/// Print only these direct subitems (with their subitems) of each printed item, all if empty
+			std::set< std::string > fields;
+		};
+		
+		/// Distinct key elements at one depth, mapped to the number of items using them
+		typedef std::unordered_map< std::string, size_t > segment_map;
+		
+		/** Returns the distinct key elements at position depth (0 for top-level keys) of all items,
+		 * the first call counts the key elements of all items
+		 */
+		const segment_map& segments( size_t depth ) const;
+		
+		/// Items with the same last key element
+		typedef std::unordered_set< const item_map::value_type* > posting_list;
+		
+		/** Returns the items whose last key element is segment,
+		 * the first call builds the lists of all key elements
+		 */
+		const posting_list& postings( const std::string& segment ) const;
+		
+		/** Creates a sorted index of the numeric and date values of all items whose last key is segment,
+		 * it is kept up to date with every change
+		 * \returns false if the index exists
+		 */
+		bool create_index( const std::string& segment );
+		
+		/// Deletes an index, \returns false if it doesn't exist
+		bool drop_index( const std::string& segment );
+		
+		/// Returns the segments with an index
+		std::vector< std::string > indexes() const;
+		
+		/// Checks if there is an index for segment
+		bool has_index( const std::string& segment ) const { return _numeric_indexes.count( segment ) != 0; }
+		
+		/** Calls found for every item whose last key is segment and that has a value matching predicate,
+		 * uses the index of segment, items with several matching values are reported for each
+		 */
+		void find_range( const std::string& segment, const value_predicate& predicate, const std::function< void( const item_map::value_type& ) >& found ) const;
+		
 		/// Print everything
-		void print( std::ostream& output, bool color );
+		void print( std::ostream& output, bool color, const print_options& projection = print_options() ) const;
 		/// Print specified key
-		void print( std::ostream& output, bool color, const keys& item_keys );
+		void print( std::ostream& output, bool color, const keys& item_keys, const print_options& projection = print_options() ) const;
 		
 		/// Load a database from a file
-		void load( std::istream& input ); // TODO!: merge/replace
+		void load( std::istream& input );
 		
-		/// Export database in graphviz format
-		void to_graphviz( std::ostream& output );
+		/** Continue loading a database, e.g. after lines have been appended to a file
+		 * \arg temp_keys the path of the last loaded item, {""} before the first line
+		 */
+		void load( std::istream& input, keys& temp_keys );
+		
+		/// Load a database from a file in the format written by to_tsv()
+		void load_tsv( std::istream& input );
+		
+		/** Parse a file in the format written by to_tsv() without adding the items to the database,
+		 * missing parent items are reported before their subitems
+		 * \arg item called for every item
+		 * \arg parent called for missing parent items instead of item if it is set, a row for
+		 * the parent may still follow and should win over it
+		 */
+		void parse_tsv( std::istream& input, const std::function< void( const keys&, values& ) >& item, const std::function< void( const keys& ) >& parent = nullptr ) const;
+		
+		/** Parse a file without adding the items to the database
+		 * \arg temp_keys the path of the last parsed item, {""} before the first line
+		 * \arg item called for every item
+		 */
+		void parse( std::istream& input, keys& temp_keys, const std::function< void( const keys&, values& ) >& item ) const;
+		
+		/** Export database in graphviz format
+		 * \arg max_depth only export items up to this depth, 0 for no limit
+		 * \arg max_children only export this many subitems per item, 0 for no limit
+		 */
+		void to_graphviz( std::ostream& output, size_t max_depth = 0, size_t max_children = 0 ) const;
 		
 		/// Export database in tsv format
-		void to_tsv( std::ostream& output );
+		void to_tsv( std::ostream& output ) const;
+		
+		/// Print items [first, last) in the file format
+		void print( std::ostream& output, item_map::const_iterator first, item_map::const_iterator last ) const;
+		
+		/// Print a snapshot in the file format
+		static void print( std::ostream& output, const frozen_items& items, char delimiter );
+		
+		/// Print items [first, last) of a snapshot in the file format
+		static void print( std::ostream& output, const frozen_items& items, char delimiter, size_t first, size_t last );
+		
+		/// Export a snapshot in tsv format
+		static void to_tsv( std::ostream& output, const frozen_items& items );
 		
 	private:
 		
 		/// All items
-		std::map< keys, values > _items;
+		item_map _items;
+		
+		/// Read optimized copy of _items, only set while it is up to date
+		std::shared_ptr< const frozen_items > _frozen;
+		
+		/// Last generation given to any textdb object
+		static std::atomic< uint64_t > _last_generation;
+		
+		/// Generation of the items
+		uint64_t _generation = ++_last_generation;
+		
+		/// Statistics of all items
+		statistics _total;
+		
+		/// Number of top-level items
+		size_t _top_level_items = 0;
+		
+		/** Statistics of each top-level item including subitems, by the map node of the
+		 * top-level item, subitems without a top-level item aren't counted
+		 */
+		std::unordered_map< const item_map::value_type*, statistics > _top_level;
+		
+		/// Top-level key of the item counted last and its entry of _top_level, items are mostly changed in order
+		std::string _last_top_level;
+		statistics* _last_top_level_statistics = nullptr;
+		bool _last_top_level_valid = false;
+		
+		/// Keys of a top-level item, reused to find the top-level item of a counted item
+		keys _top_level_keys{ std::string() };
+		
+		/// Told about every change, may be empty
+		change_listener _listener;
+		
+		/// Deduplicate value lists
+		bool _dedup = false;
+		
+		/// Value lists that can be shared by items while _dedup is on, by hash
+		std::unordered_multimap< size_t, values > _shared_values;
+		
+		/// Replaces the values of an item with an equal shared list, or adds them to _shared_values
+		void share_values( item_map::const_iterator item );
+		
+		/// Serializes building the lazy indexes below, read only commands may run concurrently
+		mutable std::mutex _lazy_mutex;
+		
+		/// Path hash → item, built on the first call to find()
+		mutable std::unordered_multimap< uint64_t, item_map::const_iterator > _paths;
+		mutable std::atomic< bool > _paths_built{ false };
+		
+		/// Removes an item from _paths
+		void erase_path( item_map::const_iterator item );
+		
+		/** Distinct key elements by position, counted on the first call to segments(),
+		 * kept up to date with every change after that
+		 */
+		mutable std::vector< segment_map > _segments;
+		mutable std::atomic< bool > _segments_counted{ false };
+		
+		/// The entry of each segment_map used last, consecutive items mostly share their first key elements
+		mutable std::vector< segment_map::value_type* > _last_segments;
+		
+		/// Adds (sign 1) or removes (sign -1) the key elements of an item to/from _segments
+		void count_segments( const item_map::value_type& item, int sign ) const;
+		
+		/** Items by last key element, built on the first call to postings(),
+		 * kept up to date with every change after that
+		 */
+		mutable std::unordered_map< std::string, posting_list > _postings;
+		mutable std::atomic< bool > _postings_built{ false };
+		
+		/// Adds (sign 1) or removes (sign -1) an item to/from _postings
+		void post( const item_map::value_type& item, int sign ) const;
+		
+		/// Numeric values of the items whose last key is the index segment, mapped to the items
+		typedef std::multimap< double, const item_map::value_type* > numeric_index;
+		
+		/// Indexes by segment
+		std::unordered_map< std::string, numeric_index > _numeric_indexes;
+		
+		/// Adds (sign 1) or removes (sign -1) an item to/from its index, if there is one
+		void index( const item_map::value_type& item, int sign );
+		
+		/// First top-level key of each shard, empty if the items aren't sharded
+		std::vector< std::string > _shards;
+		
+		/// Changed shards
+		std::vector< bool > _dirty;
+		
+		/// Generation before the last change of each shard
+		std::vector< uint64_t > _dirty_since;
+		
+		/// Shard of _last_top_level
+		size_t _last_shard = 0;
+		
+		/// Called after every change to _items
+		void changed()
+		{
+			_frozen.reset();
+			_generation = ++_last_generation;
+		}
+		
+		/// Adds the statistics of a single item to s, subtracts them if sign is -1
+		static void add_statistics( statistics& s, const item_map::value_type& item, int sign );
+		
+		/// Adds (sign 1) or removes (sign -1) an item to/from the statistics
+		void count( const item_map::value_type& item, int sign );
+		
+		// update the statistics and indexes, these are called by the modification functions
+		
+		/// Called after an item has been added
+		void on_insert( item_map::const_iterator position );
+		
+		/// Called before an item is deleted
+		void on_erase( item_map::const_iterator position );
+		
+		/// Called before the values of an item are changed
+		void on_values_changing( item_map::const_iterator position );
+		
+		/// Called after the values of an item have been changed
+		void on_values_changed( item_map::const_iterator position );
+		
+		/// Converts a const_iterator to an iterator, to change the values of an item
+		item_map::iterator to_mutable( item_map::const_iterator item ) { return _items.erase( item, item ); }
+		
+		/// Escape codes used by a single print call
+		struct color_codes
+		{
+			std::string_view key, subkey, value, subvalue, reset;
+		};
+		
+		/// Looks up the escape codes once per print call, all empty if color is false
+		color_codes resolve_colors( bool color ) const;
+		
+		/** Prints items [first, last), skips the subtrees excluded by projection
+		 * \arg root_depth depth of the printed items, projection is relative to these
+		 */
+		void print_items( output_writer& output, const color_codes& colors, item_map::const_iterator first, item_map::const_iterator last, size_t root_depth, const print_options& projection ) const;
+		
+		/// Prints items [first, last) from a frozen layout, see print_items()
+		static void print_frozen( output_writer& output, const frozen_items& items, char delimiter, const color_codes& colors, size_t first, size_t last, size_t root_depth, const print_options& projection );
 		
 		/// The delimiter used in the file
 		char _delimiter = '\t';
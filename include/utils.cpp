@@ -46,7 +46,7 @@ unsigned int textdb::count_char_at_front( std::string& in, char c )
 	return count;
 }
 
-bool textdb::compare_vectors( std::vector< std::string > v1, std::vector< std::string > v2 )
+bool textdb::compare_vectors( const std::vector< std::string >& v1, const std::vector< std::string >& v2 )
 {
 	if( v2.size() > v1.size() )
 		return false;
@@ -60,7 +60,7 @@ bool textdb::compare_vectors( std::vector< std::string > v1, std::vector< std::s
 	return true;
 }
 
-bool textdb::compare_vectors_exact( std::vector< std::string > v1, std::vector< std::string > v2 )
+bool textdb::compare_vectors_exact( const std::vector< std::string >& v1, const std::vector< std::string >& v2 )
 {
 	if( v2.size() != v1.size() )
 		return false;
@@ -74,7 +74,7 @@ bool textdb::compare_vectors_exact( std::vector< std::string > v1, std::vector<
 	return true;
 }
 
-bool textdb::compare_vectors_regex( std::vector< std::string > v1, std::vector< std::string > v2 )
+bool textdb::compare_vectors_regex( const std::vector< std::string >& v1, const std::vector< std::string >& v2 )
 {
 	if( v2.size() > v1.size() )
 		return false;
@@ -88,7 +88,7 @@ bool textdb::compare_vectors_regex( std::vector< std::string > v1, std::vector<
 	return true;
 }
 
-bool textdb::compare_vectors_regex_exact( std::vector< std::string > v1, std::vector< std::string > v2 )
+bool textdb::compare_vectors_regex_exact( const std::vector< std::string >& v1, const std::vector< std::string >& v2 )
 {
 	if( v2.size() != v1.size() )
 		return false;
@@ -101,3 +101,40 @@ bool textdb::compare_vectors_regex_exact( std::vector< std::string > v1, std::ve
 	
 	return true;
 }
+
+bool textdb::is_literal( const std::string& term )
+{
+	return term.find_first_of( "^$\\.*+?()[]{}|" ) == std::string::npos;
+}
+
+bool textdb::is_literal( const std::vector< std::string >& terms )
+{
+	for( auto& term : terms )
+	{
+		if( !is_literal( term ) )
+			return false;
+	}
+	
+	return true;
+}
+
+uint64_t textdb::hash( std::string_view data, uint64_t h )
+{
+	for( unsigned char c : data )
+	{
+		h ^= c;
+		h *= 1099511628211ULL;
+	}
+	
+	return h;
+}
+
+uint64_t textdb::hash( const std::vector< std::string >& path )
+{
+	// hash the elements one after another, with a separator so that {"ab"} and {"a","b"} differ
+	uint64_t h = hash( std::string_view() );
+	for( auto& element : path )
+		h = hash( std::string_view( "", 1 ), hash( element, h ) );
+	
+	return h;
+}
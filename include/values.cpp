@@ -0,0 +1,335 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+// Member functions for value_list
+
+#include "values.h"
+
+value_list::const_iterator value_list::begin() const
+{
+	if( auto one = std::get_if< std::string >( &_values ) )
+		return const_iterator( one, nullptr, 0, 1 );
+	
+	if( auto shared = std::get_if< std::shared_ptr< data > >( &_values ) )
+	{
+		const data& d = **shared;
+		return const_iterator( d.values.data(), d.erased ? &d.erased->slots : nullptr, 0, d.values.size() );
+	}
+	
+	return const_iterator();
+}
+
+value_list::const_iterator value_list::end() const
+{
+	if( std::holds_alternative< std::string >( _values ) )
+		return const_iterator( nullptr, nullptr, 1, 1 );
+	
+	if( auto shared = std::get_if< std::shared_ptr< data > >( &_values ) )
+		return const_iterator( nullptr, nullptr, (*shared)->values.size(), (*shared)->values.size() );
+	
+	return const_iterator();
+}
+
+size_t value_list::size() const
+{
+	if( std::holds_alternative< std::string >( _values ) )
+		return 1;
+	
+	if( auto shared = std::get_if< std::shared_ptr< data > >( &_values ) )
+		return (*shared)->values.size() - ( (*shared)->erased ? (*shared)->erased->count : 0 );
+	
+	return 0;
+}
+
+size_t value_list::bytes() const
+{
+	if( auto one = std::get_if< std::string >( &_values ) )
+		return one->size();
+	
+	if( auto shared = std::get_if< std::shared_ptr< data > >( &_values ) )
+		return (*shared)->bytes;
+	
+	return 0;
+}
+
+bool value_list::contains( const std::string& value ) const
+{
+	if( auto one = std::get_if< std::string >( &_values ) )
+		return *one == value;
+	
+	auto shared = std::get_if< std::shared_ptr< data > >( &_values );
+	if( !shared )
+		return false;
+	
+	// small list: linear search, small lists have no erased slots
+	const data& d = **shared;
+	if( !d.index )
+	{
+		for( auto& v : d.values )
+		{
+			if( v == value )
+				return true;
+		}
+		return false;
+	}
+	
+	// hashed lookup, erased values aren't indexed
+	auto range = d.index->equal_range( std::hash< std::string >()( value ) );
+	for( auto i = range.first; i != range.second; i++ )
+	{
+		if( d.values[i->second] == value )
+			return true;
+	}
+	return false;
+}
+
+void value_list::push_back( const std::string& value )
+{
+	if( empty() )
+	{
+		_values = value;
+		return;
+	}
+	
+	data& d = modify();
+	d.values.push_back( value );
+	d.bytes += value.size();
+	if( d.erased )
+		d.erased->slots.push_back( false );
+	
+	if( d.index )
+		d.index->emplace( std::hash< std::string >()( value ), d.values.size()-1 );
+	else if( d.values.size() > index_threshold )
+		reindex( d );
+}
+
+bool value_list::insert( const std::string& value )
+{
+	if( contains( value ) )
+		return false;
+	
+	push_back( value );
+	return true;
+}
+
+size_t value_list::erase( const std::string& value )
+{
+	if( !contains( value ) )
+		return 0;
+	
+	if( !shareable() )
+	{
+		_values = std::monostate();
+		return 1;
+	}
+	
+	data& d = modify();
+	if( !d.index )
+		return erase_if( [&value]( const std::string& v ){ return v == value; } );
+	
+	// indexed: mark the slots found by the hash as erased
+	size_t removed = 0;
+	auto range = d.index->equal_range( std::hash< std::string >()( value ) );
+	for( auto i = range.first; i != range.second; )
+	{
+		if( d.values[i->second] == value && mark_erased( d, i->second ) )
+		{
+			removed++;
+			i = d.index->erase( i );
+		}
+		else
+			i++;
+	}
+	
+	compact();
+	return removed;
+}
+
+size_t value_list::erase_if( const std::function< bool( const std::string& ) >& predicate )
+{
+	// find the first removed value without copying shared values
+	auto first = begin();
+	while( first != end() && !predicate( *first ) )
+		first++;
+	
+	if( first == end() )
+		return 0;
+	
+	if( !shareable() )
+	{
+		_values = std::monostate();
+		return 1;
+	}
+	
+	data& d = modify();
+	size_t removed = 0;
+	
+	// indexed: mark the matching slots as erased and drop their index entries
+	if( d.index )
+	{
+		std::hash< std::string > hasher;
+		for( size_t i = 0; i < d.values.size(); i++ )
+		{
+			if( ( d.erased && d.erased->slots[i] ) || !predicate( d.values[i] ) )
+				continue;
+			
+			auto range = d.index->equal_range( hasher( d.values[i] ) );
+			for( auto entry = range.first; entry != range.second; entry++ )
+			{
+				if( entry->second == i )
+				{
+					d.index->erase( entry );
+					break;
+				}
+			}
+			
+			mark_erased( d, i );
+			removed++;
+		}
+		
+		compact();
+		return removed;
+	}
+	
+	// small list: compact in place
+	size_t kept = 0;
+	for( size_t i = 0; i < d.values.size(); i++ )
+	{
+		if( predicate( d.values[i] ) )
+		{
+			d.bytes -= d.values[i].size();
+			continue;
+		}
+		
+		if( kept != i )
+			d.values[kept] = std::move( d.values[i] );
+		kept++;
+	}
+	
+	removed = d.values.size() - kept;
+	d.values.resize( kept );
+	if( kept == 0 )
+		_values = std::monostate();
+	return removed;
+}
+
+size_t value_list::hash() const
+{
+	size_t h = size();
+	for( auto& v : *this )
+		h = h * 1099511628211ULL ^ std::hash< std::string >()( v );
+	
+	return h;
+}
+
+bool value_list::operator==( const value_list& other ) const
+{
+	auto shared = std::get_if< std::shared_ptr< data > >( &_values );
+	auto other_shared = std::get_if< std::shared_ptr< data > >( &other._values );
+	if( shared && other_shared && *shared == *other_shared )
+		return true;
+	
+	return size() == other.size() && std::equal( begin(), end(), other.begin() );
+}
+
+value_list::data::data( const data& other ) :
+	values( other.values ), erased( other.erased ? std::make_unique< erased_slots >( *other.erased ) : nullptr ), bytes( other.bytes ),
+	index( other.index ? std::make_unique< std::unordered_multimap< size_t, size_t > >( *other.index ) : nullptr )
+{
+}
+
+value_list::data& value_list::modify()
+{
+	if( auto one = std::get_if< std::string >( &_values ) )
+	{
+		auto d = std::make_shared< data >();
+		d->bytes = one->size();
+		d->values.reserve( 2 );
+		d->values.push_back( std::move( *one ) );
+		_values = std::move( d );
+	}
+	else if( std::holds_alternative< std::monostate >( _values ) )
+		_values = std::make_shared< data >();
+	
+	auto& shared = std::get< std::shared_ptr< data > >( _values );
+	if( shared.use_count() > 1 )
+		shared = std::make_shared< data >( *shared );
+	
+	return *shared;
+}
+
+bool value_list::mark_erased( data& d, size_t position )
+{
+	if( !d.erased )
+	{
+		d.erased = std::make_unique< erased_slots >();
+		d.erased->slots.resize( d.values.size(), false );
+	}
+	
+	if( d.erased->slots[position] )
+		return false;
+	
+	d.erased->slots[position] = true;
+	d.erased->count++;
+	d.bytes -= d.values[position].size();
+	return true;
+}
+
+void value_list::compact()
+{
+	data& d = *std::get< std::shared_ptr< data > >( _values );
+	size_t erased = d.erased ? d.erased->count : 0;
+	if( erased == d.values.size() )
+	{
+		_values = std::monostate();
+		return;
+	}
+	
+	// the cost of compacting is spread over the erases since the last compaction
+	if( erased * 2 <= d.values.size() )
+		return;
+	
+	size_t kept = 0;
+	for( size_t i = 0; i < d.values.size(); i++ )
+	{
+		if( d.erased->slots[i] )
+			continue;
+		
+		if( kept != i )
+			d.values[kept] = std::move( d.values[i] );
+		kept++;
+	}
+	
+	d.values.resize( kept );
+	d.erased.reset();
+	reindex( d );
+}
+
+void value_list::reindex( data& d )
+{
+	if( d.values.size() <= index_threshold )
+	{
+		d.index.reset();
+		return;
+	}
+	
+	d.index = std::make_unique< std::unordered_multimap< size_t, size_t > >();
+	d.index->reserve( d.values.size() );
+	for( size_t i = 0; i < d.values.size(); i++ )
+		d.index->emplace( std::hash< std::string >()( d.values[i] ), i );
+}
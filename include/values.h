@@ -0,0 +1,199 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+// Value container header
+
+#ifndef TEXTDB_VALUES
+#define TEXTDB_VALUES
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <functional>
+#include <memory>
+#include <iterator>
+#include <algorithm>
+#include <cstddef>
+#include <variant>
+
+/** Holds the values of a single item in insertion order.
+ * A single value is kept inline, most items have one and need no allocation
+ * for it. Longer lists are searched linearly, above index_threshold values a
+ * hash index is kept so that lookups don't depend on the number of values.
+ * Values removed from an indexed list are only marked as erased, the list
+ * is compacted once half of its slots are erased (O(1) amortized deletes).
+ * Copies of lists with more than one value share them until one of the
+ * copies is changed (copy on write), empty lists don't allocate.
+ */
+class value_list
+{
+	
+	private:
+		
+		struct data;
+		struct erased_slots;
+		
+	public:
+		
+		/// Iterates over the values that are not erased
+		class const_iterator
+		{
+			public:
+				
+				typedef std::forward_iterator_tag iterator_category;
+				typedef std::string value_type;
+				typedef std::ptrdiff_t difference_type;
+				typedef const std::string* pointer;
+				typedef const std::string& reference;
+				
+				const_iterator() {}
+				const_iterator( const std::string* values, const std::vector< bool >* erased, size_t position, size_t size ) :
+					_values( values ), _erased( erased ), _position( position ), _size( size ) { skip(); }
+				
+				reference operator*() const { return _values[_position]; }
+				pointer operator->() const { return &_values[_position]; }
+				
+				const_iterator& operator++() { _position++; skip(); return *this; }
+				const_iterator operator++( int ) { const_iterator previous = *this; ++*this; return previous; }
+				
+				bool operator==( const const_iterator& other ) const { return _position == other._position; }
+				bool operator!=( const const_iterator& other ) const { return _position != other._position; }
+				
+			private:
+				
+				const std::string* _values = nullptr;
+				
+				/// Erased slots, nullptr if there are none
+				const std::vector< bool >* _erased = nullptr;
+				
+				size_t _position = 0, _size = 0;
+				
+				/// Moves past erased slots
+				void skip()
+				{
+					if( _erased )
+					{
+						while( _position < _size && (*_erased)[_position] )
+							_position++;
+					}
+				}
+		};
+		
+		typedef const_iterator iterator;
+		
+		/// Lists with more values than this are indexed
+		static const size_t index_threshold = 4;
+		
+		value_list() {}
+		
+		/// Construct from a range of strings, duplicates are kept
+		template< class input_iterator > value_list( input_iterator first, input_iterator last )
+		{
+			for( ; first != last; first++ )
+				push_back( *first );
+		}
+		
+		const_iterator begin() const;
+		const_iterator end() const;
+		size_t size() const;
+		bool empty() const { return std::holds_alternative< std::monostate >( _values ); }
+		
+		/// Total length of all values in bytes
+		size_t bytes() const;
+		
+		/// Checks if value is in the list
+		bool contains( const std::string& value ) const;
+		
+		/// Appends value, even if it is already in the list
+		void push_back( const std::string& value );
+		
+		/** Appends value if it is not already in the list
+		 * \returns true if the value was added
+		 */
+		bool insert( const std::string& value );
+		
+		/** Removes all occurrences of value, O(1) amortized for indexed lists
+		 * \returns the number of removed values
+		 */
+		size_t erase( const std::string& value );
+		
+		/** Removes all values for which predicate returns true in a single pass,
+		 * the order of the remaining values is preserved
+		 * \returns the number of removed values
+		 */
+		size_t erase_if( const std::function< bool( const std::string& ) >& predicate );
+		
+		/// Hash of the values, equal lists have equal hashes
+		size_t hash() const;
+		
+		/// Checks if copies of the list share its values, only lists with more than one value do
+		bool shareable() const { return std::holds_alternative< std::shared_ptr< data > >( _values ); }
+		
+		/// Number of lists sharing the values, 0 if the values can't be shared
+		long use_count() const { return shareable() ? std::get< std::shared_ptr< data > >( _values ).use_count() : 0; }
+		
+		bool operator==( const value_list& other ) const;
+		bool operator!=( const value_list& other ) const { return !( *this == other ); }
+		
+	private:
+		
+		/// Kept only for lists with erased slots, most lists never have any
+		struct erased_slots
+		{
+			/// One flag per slot of data::values
+			std::vector< bool > slots;
+			size_t count = 0;
+		};
+		
+		/// Values of a list with more than one value
+		struct data
+		{
+			data() {}
+			data( const data& other );
+			
+			/// The values in insertion order, including erased slots
+			std::vector< std::string > values;
+			
+			/// Erased slots of values, nullptr while no slot is erased
+			std::unique_ptr< erased_slots > erased;
+			
+			/// Total length of the values that are not erased
+			size_t bytes = 0;
+			
+			/// Hash of a value → position in values, nullptr while there are no more than index_threshold values
+			std::unique_ptr< std::unordered_multimap< size_t, size_t > > index;
+		};
+		
+		/// No values, a single value or the values shared by copies
+		std::variant< std::monostate, std::string, std::shared_ptr< data > > _values;
+		
+		/// Returns the shared values for changing, copies them if other lists use them too, moves a single value into them
+		data& modify();
+		
+		/// Marks slot position of d as erased, \returns false if it already is
+		static bool mark_erased( data& d, size_t position );
+		
+		/// Removes the erased slots of d if there are many, resets the list if it is empty
+		void compact();
+		
+		/// Rebuilds the index of d
+		static void reindex( data& d );
+		
+};
+
+#endif
@@ -0,0 +1,358 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+// Member functions for file_watcher
+
+#include "watcher.h"
+
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+bool file_watcher::watch( const std::string& filename, char delimiter )
+{
+	stop();
+	
+#ifdef __linux__
+	_fd = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+	if( _fd < 0 )
+		return false;
+	
+	_filename = filename;
+	_delimiter = delimiter;
+	
+	// remember the current state of the file
+	std::string data;
+	if( !add_watch() || !stat_file( _state ) || !read( 0, -1, data ) )
+	{
+		stop();
+		return false;
+	}
+	
+	_path = textdb::keys({""});
+	scan( data, 0 );
+	_size = data.size();
+	return true;
+#else
+	(void)filename;
+	(void)delimiter;
+	return false;
+#endif
+}
+
+void file_watcher::stop()
+{
+	if( _fd >= 0 )
+		close( _fd );
+	
+	_fd = -1;
+	_wd = -1;
+	_filename.clear();
+	_blocks.clear();
+	_size = 0;
+	_state = file_state();
+	_complete = true;
+}
+
+bool file_watcher::add_watch()
+{
+#ifdef __linux__
+	_wd = inotify_add_watch( _fd, _filename.c_str(), IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF );
+	return _wd >= 0;
+#else
+	return false;
+#endif
+}
+
+bool file_watcher::update( textdb& db )
+{
+#ifdef __linux__
+	if( _fd < 0 )
+		return false;
+	
+	bool changed = false, replaced = false;
+	
+	// read all pending events
+	alignas( struct inotify_event ) char buffer[4096];
+	for( ssize_t length; ( length = ::read( _fd, buffer, sizeof(buffer) ) ) > 0; )
+	{
+		for( char* e = buffer; e < buffer + length; )
+		{
+			auto event = reinterpret_cast< struct inotify_event* >( e );
+			
+			if( event->mask & ( IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB ) )
+				changed = true;
+			if( event->mask & ( IN_MOVE_SELF | IN_DELETE_SELF | IN_IGNORED ) )
+				replaced = true;
+			
+			e += sizeof( struct inotify_event ) + event->len;
+		}
+	}
+	
+	// the file was replaced (e.g. by an editor), watch the new file
+	if( replaced || _wd < 0 )
+	{
+		if( _wd >= 0 )
+			inotify_rm_watch( _fd, _wd );
+		
+		if( !add_watch() )
+			return false;
+		
+		changed = true;
+	}
+	
+	if( !changed )
+		return false;
+	
+	if( !append( db ) )
+		resync( db );
+	
+	return true;
+#else
+	(void)db;
+	return false;
+#endif
+}
+
+bool file_watcher::saved( textdb& db, const file_state& written )
+{
+#ifdef __linux__
+	if( _fd < 0 )
+		return false;
+	
+	// the save replaced the file, its events are handled here
+	if( _wd >= 0 )
+		inotify_rm_watch( _fd, _wd );
+	
+	alignas( struct inotify_event ) char buffer[4096];
+	while( ::read( _fd, buffer, sizeof(buffer) ) > 0 );
+	
+	if( !add_watch() )
+		return false;
+	
+	// the saved file starts the watched one as long as it wasn't replaced since
+	file_state state;
+	std::string data;
+	if( stat_file( state ) && state.device == written.device && state.inode == written.inode
+		&& state.size >= written.size && read( 0, written.size, data ) )
+	{
+		_state = written;
+		_blocks.clear();
+		_complete = true;
+		_path = textdb::keys({""});
+		scan( data, 0 );
+		_size = data.size();
+	}
+	
+	// changes after the save
+	if( !append( db ) )
+		resync( db );
+	
+	return true;
+#else
+	(void)db;
+	(void)written;
+	return false;
+#endif
+}
+
+void file_watcher::scan( const std::string& data, size_t offset )
+{
+	for( size_t begin = 0, end = 0; begin < data.size(); begin = end )
+	{
+		end = data.find( '\n', begin );
+		end = ( end == std::string::npos ) ? data.size() : end+1;
+		
+		std::string_view line( data.data()+begin, end-begin );
+		
+		// depth and first field of the line
+		size_t depth = line.find_first_not_of( _delimiter );
+		std::string key;
+		if( depth != std::string_view::npos )
+			key = std::string( line.substr( depth, line.find_first_of( std::string{ _delimiter, '\n' }, depth ) - depth ) );
+		
+		// a top-level item starts a new block
+		if( depth == 0 && !key.empty() )
+			_blocks.push_back( { key, offset+begin, 0, textdb::hash( "" ) } );
+		else if( _blocks.empty() )
+			_blocks.push_back( { "", offset+begin, 0, textdb::hash( "" ) } );
+		
+		_blocks.back().size += line.size();
+		_blocks.back().hash = textdb::hash( line, _blocks.back().hash );
+		
+		// parser state, the same rules as textdb::load()
+		if( !key.empty() && depth <= _path.size() )
+		{
+			_path.resize( depth );
+			_path.push_back( key );
+		}
+	}
+	
+	if( !data.empty() )
+		_complete = ( data.back() == '\n' );
+}
+
+bool file_watcher::append( textdb& db )
+{
+	file_state state;
+	if( !stat_file( state ) )
+		return false;
+	
+	// a new file (e.g. moved over the old one by sed -i) is compared block by block
+	if( state.device != _state.device || state.inode != _state.inode )
+		return false;
+	
+	size_t size = state.size;
+	if( !_complete || size < _size )
+		return false;
+	
+	// same size: unchanged unless it was written to in place
+	if( size == _size )
+		return state.mtime == _state.mtime;
+	
+	// the last block has to be unchanged
+	if( !_blocks.empty() )
+	{
+		std::string last;
+		if( !read( _blocks.back().offset, _blocks.back().size, last ) || textdb::hash( last ) != _blocks.back().hash )
+			return false;
+	}
+	
+	// parse complete lines only, the rest is parsed by a later update
+	std::string tail;
+	if( !read( _size, size - _size, tail ) )
+		return false;
+	
+	_state = state;
+	size_t complete = tail.rfind( '\n' );
+	if( complete == std::string::npos )
+		return true;
+	tail.resize( complete+1 );
+	
+	std::istringstream input( tail );
+	textdb::keys path = _path;
+	db.load( input, path );
+	
+	scan( tail, _size );
+	_size += tail.size();
+	return true;
+}
+
+void file_watcher::resync( textdb& db )
+{
+	// the state is taken first, a write during the read causes another resync
+	file_state state;
+	std::string data;
+	if( !stat_file( state ) || !read( 0, -1, data ) )
+		return;
+	_state = state;
+	
+	// combined hash of all blocks with the same key
+	auto block_hashes = []( const std::vector< block >& blocks )
+	{
+		std::unordered_map< std::string, uint64_t > hashes;
+		for( auto& b : blocks )
+		{
+			auto h = hashes.try_emplace( b.key, textdb::hash( "" ) ).first;
+			h->second = textdb::hash( std::string_view( reinterpret_cast< const char* >( &b.hash ), sizeof(b.hash) ), h->second );
+		}
+		return hashes;
+	};
+	
+	auto old_hashes = block_hashes( _blocks );
+	
+	_blocks.clear();
+	_path = textdb::keys({""});
+	scan( data, 0 );
+	_size = data.size();
+	
+	auto new_hashes = block_hashes( _blocks );
+	
+	// delete items of removed blocks
+	for( auto& h : old_hashes )
+	{
+		if( new_hashes.find( h.first ) == new_hashes.end() )
+		{
+			auto range = db.subtree( textdb::keys({ h.first }) );
+			db.erase( range.first, range.second );
+		}
+	}
+	
+	// collect the text of changed blocks
+	std::unordered_map< std::string, std::string > changed;
+	for( auto& b : _blocks )
+	{
+		auto old_hash = old_hashes.find( b.key );
+		if( old_hash == old_hashes.end() || old_hash->second != new_hashes.at( b.key ) )
+			changed[b.key].append( data, b.offset, b.size );
+	}
+	
+	// parse changed blocks again
+	for( auto& c : changed )
+	{
+		auto range = db.subtree( textdb::keys({ c.first }) );
+		db.erase( range.first, range.second );
+		
+		std::istringstream input( c.second );
+		db.load( input );
+	}
+}
+
+bool file_watcher::read( size_t offset, size_t size, std::string& data ) const
+{
+	std::ifstream infile( _filename, std::ios::binary );
+	if( !infile.is_open() )
+		return false;
+	
+	if( size == (size_t)-1 )
+	{
+		std::ostringstream content;
+		content << infile.rdbuf();
+		data = content.str();
+		return true;
+	}
+	
+	data.resize( size );
+	infile.seekg( offset );
+	infile.read( data.data(), size );
+	return (size_t)infile.gcount() == size;
+}
+
+bool file_watcher::stat_file( file_state& state ) const
+{
+	struct stat file_stat;
+	if( stat( _filename.c_str(), &file_stat ) != 0 )
+		return false;
+	
+	state.device = file_stat.st_dev;
+	state.inode = file_stat.st_ino;
+#ifdef __linux__
+	state.mtime = (int64_t)file_stat.st_mtim.tv_sec * 1000000000 + file_stat.st_mtim.tv_nsec;
+#else
+	state.mtime = (int64_t)file_stat.st_mtime * 1000000000;
+#endif
+	state.size = file_stat.st_size;
+	return true;
+}
@@ -0,0 +1,137 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+// File watcher header
+
+#ifndef TEXTDB_WATCHER
+#define TEXTDB_WATCHER
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "textdb.h"
+
+/** Watches the file a database was loaded from (with inotify) and applies
+ * external changes to the database:
+ * - appended lines are parsed without reading the rest of the file
+ * - for other changes the file is split into top-level blocks, only blocks
+ *   that differ from the last known state are parsed again
+ */
+class file_watcher
+{
+	
+	public:
+		
+		file_watcher() {}
+		~file_watcher() { stop(); }
+		
+		file_watcher( const file_watcher& ) = delete;
+		file_watcher& operator=( const file_watcher& ) = delete;
+		
+		/** Starts watching filename, db has to be loaded from filename already
+		 * \returns false if the file can't be watched
+		 */
+		bool watch( const std::string& filename, char delimiter );
+		
+		/// Stops watching
+		void stop();
+		
+		/// Returns the name of the watched file, empty if no file is watched
+		const std::string& filename() const { return _filename; }
+		
+		/** Applies changes to the file since the last call to db
+		 * \returns true if the file has changed
+		 */
+		bool update( textdb& db );
+		
+		/// What stat(2) reports about the file
+		struct file_state
+		{
+			uint64_t device = 0, inode = 0;
+			/// Modification time in nanoseconds
+			int64_t mtime = 0;
+			size_t size = 0;
+		};
+		
+		/** Takes the file the database was saved to as the last known state,
+		 * so the save isn't applied to db, written describes the saved file.
+		 * Changes made to the file after the save are applied to db.
+		 * \returns false if the file can't be watched anymore
+		 */
+		bool saved( textdb& db, const file_state& written );
+		
+	private:
+		
+		/// A top-level item and its subitems in the file
+		struct block
+		{
+			/// The top-level key
+			std::string key;
+			/// Position in the file
+			size_t offset, size;
+			/// Hash of the bytes of the block
+			uint64_t hash;
+		};
+		
+		std::string _filename;
+		char _delimiter = '\t';
+		
+		/// inotify instance and watch descriptors, -1 if not used
+		int _fd = -1, _wd = -1;
+		
+		/// Blocks of the file at the last update
+		std::vector< block > _blocks;
+		
+		/// Size of the file at the last update
+		size_t _size = 0;
+		
+		/// The file at the last update, a different inode or mtime means the file was rewritten
+		file_state _state;
+		
+		/// Does the file end with a complete line
+		bool _complete = true;
+		
+		/// Parser state at the end of the file
+		textdb::keys _path;
+		
+		/// Adds the inotify watch for _filename
+		bool add_watch();
+		
+		/** Appends the blocks in data, which starts at offset in the file
+		 * and continues the last block if it starts with a subitem
+		 */
+		void scan( const std::string& data, size_t offset );
+		
+		/** Parses only the appended part of the file, \returns false if the file
+		 * was replaced, or rewritten without growing
+		 */
+		bool append( textdb& db );
+		
+		/// Parses all blocks that have changed
+		void resync( textdb& db );
+		
+		/// Reads [offset, offset+size) from the file, size -1 to read up to the end
+		bool read( size_t offset, size_t size, std::string& data ) const;
+		
+		/// Gets the state of the file, \returns false if it doesn't exist
+		bool stat_file( file_state& state ) const;
+		
+};
+
+#endif
@@ -0,0 +1,177 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+// Member functions for output_writer
+
+#include "writer.h"
+
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/uio.h>
+
+namespace
+{
+	/// Buffers of destroyed writers, each thread reuses its own
+	thread_local std::vector< std::unique_ptr< char[] > > free_buffers;
+}
+
+output_writer::output_writer( std::ostream& output ) : _output( output )
+{
+	// a search prints once per result root, don't allocate a buffer for each
+	if( free_buffers.empty() )
+		_buffer.reset( new char[buffer_size] );
+	else
+	{
+		_buffer = std::move( free_buffers.back() );
+		free_buffers.pop_back();
+	}
+	
+	// write directly to stdout, everything already written to std::cout has to go first
+	auto tee = dynamic_cast< tee_buffer* >( output.rdbuf() );
+	if( tee && tee->target() == std::cout.rdbuf() )
+		_tee = tee;
+	
+	if( &output == &std::cout || _tee )
+	{
+		std::cout.flush();
+		std::fflush( stdout );
+		_fd = STDOUT_FILENO;
+	}
+}
+
+output_writer::~output_writer()
+{
+	flush();
+	free_buffers.push_back( std::move( _buffer ) );
+}
+
+void output_writer::flush()
+{
+	if( _used == 0 )
+		return;
+	
+	if( _fd >= 0 )
+		write_fd( _buffer.get(), _used );
+	else
+		_output.write( _buffer.get(), _used );
+	
+	_used = 0;
+}
+
+void output_writer::write_large( std::string_view s )
+{
+	// fits after a flush
+	if( s.size() <= buffer_size )
+	{
+		flush();
+		s.copy( _buffer.get(), s.size() );
+		_used = s.size();
+		return;
+	}
+	
+	if( _fd < 0 )
+	{
+		flush();
+		_output.write( s.data(), s.size() );
+		return;
+	}
+	
+	// buffer and string with one system call
+	if( _error != 0 || _output.bad() )
+	{
+		_used = 0;
+		return;
+	}
+	
+	struct iovec parts[2] =
+	{
+		{ _buffer.get(), _used },
+		{ const_cast< char* >( s.data() ), s.size() }
+	};
+	
+	ssize_t written;
+	do
+		written = writev( _fd, parts, 2 );
+	while( written < 0 && errno == EINTR );
+	
+	if( written < 0 )
+	{
+		_used = 0;
+		fail( errno );
+		return;
+	}
+	
+	if( _tee )
+	{
+		size_t copied = std::min< size_t >( written, _used );
+		_tee->copy( _buffer.get(), copied );
+		_tee->copy( s.data(), written - copied );
+	}
+	
+	// partial write: write the rest
+	size_t done = written;
+	if( done < _used )
+	{
+		write_fd( _buffer.get() + done, _used - done );
+		done = 0;
+	}
+	else
+		done -= _used;
+	
+	_used = 0;
+	write_fd( s.data() + done, s.size() - done );
+}
+
+void output_writer::write_fd( const char* data, size_t size )
+{
+	// an earlier writer failed, the output is incomplete anyway
+	if( _output.bad() )
+		return;
+	
+	while( size > 0 && _error == 0 )
+	{
+		ssize_t written = ::write( _fd, data, size );
+		if( written < 0 )
+		{
+			if( errno == EINTR )
+				continue;
+			fail( errno );
+			return;
+		}
+		
+		if( _tee )
+			_tee->copy( data, written );
+		
+		data += written;
+		size -= written;
+	}
+}
+
+void output_writer::fail( int error )
+{
+	if( _error != 0 )
+		return;
+	
+	_error = error;
+	_output.setstate( std::ios::badbit );
+	std::cerr << "Could not write output: " << std::strerror( error ) << "\n";
+}
@@ -0,0 +1,130 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ */
+
+// Buffered output writer header
+
+#ifndef TEXTDB_WRITER
+#define TEXTDB_WRITER
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <streambuf>
+
+/** Stream buffer that passes output on to another stream buffer and keeps a copy of it.
+ * output_writer writes directly to stdout when the target is the buffer of std::cout
+ * and only hands the written output to copy().
+ */
+class tee_buffer : public std::streambuf
+{
+	
+	public:
+		
+		/// The stream buffer the output is passed on to
+		virtual std::streambuf* target() const = 0;
+		
+		/// Keeps a copy of output that has been written to the target in another way
+		virtual void copy( const char* data, size_t size ) = 0;
+		
+};
+
+/** Collects output in a large buffer and writes it in big blocks.
+ * Output to std::cout, directly or through a tee_buffer, is written to the
+ * stdout file descriptor with write(2)/writev(2), other streams get whole
+ * blocks with ostream::write.
+ * Nothing is flushed before the buffer is full or the writer is destroyed.
+ * The buffer is reused by the next writer of the same thread, a failed
+ * write sets badbit on the stream and is reported on std::cerr.
+ */
+class output_writer
+{
+	
+	public:
+		
+		/// Size of the output buffer
+		static const size_t buffer_size = 1 << 18;
+		
+		explicit output_writer( std::ostream& output );
+		~output_writer();
+		
+		output_writer( const output_writer& ) = delete;
+		output_writer& operator=( const output_writer& ) = delete;
+		
+		/// Appends s to the buffer, large strings bypass the buffer
+		void write( std::string_view s )
+		{
+			if( s.size() <= buffer_size - _used )
+			{
+				s.copy( _buffer.get() + _used, s.size() );
+				_used += s.size();
+			}
+			else
+				write_large( s );
+		}
+		
+		/// Appends c to the buffer
+		void put( char c )
+		{
+			if( _used == buffer_size )
+				flush();
+			_buffer[_used++] = c;
+		}
+		
+		/// Appends count times c to the buffer
+		void put( char c, size_t count )
+		{
+			while( count-- > 0 )
+				put( c );
+		}
+		
+		/// Writes the buffer
+		void flush();
+		
+		/// The errno of the first failed write to the file descriptor, 0 if there was none
+		int error() const { return _error; }
+		
+	private:
+		
+		/// The stream that is written to if _fd is -1
+		std::ostream& _output;
+		
+		/// File descriptor for direct output, -1 if not used
+		int _fd = -1;
+		
+		/// Gets a copy of the direct output if the stream writes through it, nullptr otherwise
+		tee_buffer* _tee = nullptr;
+		
+		std::unique_ptr< char[] > _buffer;
+		size_t _used = 0;
+		
+		/// Set by the first failed write, later output is dropped
+		int _error = 0;
+		
+		/// Records a failed write
+		void fail( int error );
+		
+		/// Writes the buffer and s with a single system call if possible
+		void write_large( std::string_view s );
+		
+		/// Writes data to _fd, handles partial writes
+		void write_fd( const char* data, size_t size );
+		
+};
+
+#endif
@@ -23,6 +23,9 @@
 #include <vector>
 #include <exception>
 #include <regex>
+#include <sstream>
+#include <thread>
+#include <memory>
 
 #include <cstdio>
 #include <cerrno>
@@ -31,6 +34,7 @@
 
 #include "include/textdb.h"
 #include "include/frontend.h"
+#include "include/queue.h"
 
 // version string fallback, change version in makefile
 #ifndef VERSION_STRING
@@ -51,7 +55,15 @@ int main( int argc, char* argv[] )
 	{
 		{ "ps1", ">> " },
 		{ "color", "on" },
-		{ "regex", "on" }
+		{ "regex", "on" },
+		{ "watch", "off" },
+		{ "cache", "on" },
+		{ "autosave", "0" },
+		{ "dedup", "off" },
+		{ "publish", "off" },
+		{ "follow", "off" },
+		{ "depth", "0" },
+		{ "fields", "*" }
 	};
 	
 	// check arguments, load file
@@ -67,24 +79,39 @@ int main( int argc, char* argv[] )
 		// load database from stdin
 		else if( strcmp( argv[1], "-" ) == 0 )
 		{
-			db.items().clear();
+			db.clear();
 			db.load( std::cin );
 		}
 		
+		// load sharded collection
+		else if( shard_manifest::is_sharded( argv[1] ) )
+		{
+			std::string filename = argv[1];
+			command_load_file( filename, db, options, std::cerr );
+			if( options.find( "file" ) == options.end() )
+				return 1;
+		}
+		
 		// load database from specified file
 		else
 		{
-			std::ifstream infile( argv[1] );
+			input_file infile( argv[1] );
 			if( !infile.is_open() )
 			{
-				std::cerr << "Could not open " << argv[1] << "\n";
+				std::cerr << ( infile.error().empty() ? std::string( "Could not open " ) + argv[1] : infile.error() ) << "\n";
 				return 1;
 			}
 			
 			options["file"] = argv[1];
-			db.items().clear();
-			db.load( infile );
+			db.clear();
+			if( is_tsv_file( argv[1] ) )
+				db.load_tsv( infile );
+			else
+				db.load( infile );
 			infile.close();
+			
+			if( !infile.error().empty() )
+				std::cerr << infile.error() << "\n";
 		}
 	}
 	
@@ -95,6 +122,9 @@ int main( int argc, char* argv[] )
 		for( int i = 2; i < argc; i++ )
 			command += argv[i];
 		
+		// a single command has nothing to reuse a cached result for
+		options["cache"] = "off";
+		
 		if( isatty( fileno(stdout) ) )
 			process_input( command, db, options, std::cout );
 		else if( errno == ENOTTY )
@@ -103,7 +133,8 @@ int main( int argc, char* argv[] )
 			process_input( command, db, options, std::cout );
 		}
 		
-		return 0;
+		command_wait_saves( std::cout );
+		return std::cout.bad() ? 1 : 0;
 	}
 	
 	// is stdout connected to a pipe ?
@@ -127,32 +158,256 @@ void interactive_session( textdb& db, std::map< std::string, std::string >& opti
 	// input buffer
 	std::string input;
 	
+	// applies external changes to the opened file
+	file_watcher watcher;
+	
+	// publishes or follows changes
+	change_feed feed;
+	change_follower follower;
+	
 	//main loop, process user input
 	while(1)
 	{
 		std::cout << options.at("ps1");
 		std::getline( std::cin, input, '\n' );
 		
+		// autosaves of the saver thread wait until the command is done
+		auto busy = lock_session();
+		command_sync_file( watcher, db, options, std::cout );
+		command_replicate( feed, follower, db, options, std::cout );
+		command_background_save( db, options, std::cout );
+		
 		if( !std::cin.bad() && !std::cin.eof() )
 			process_input( input, db, options, std::cout );
 		else
 			break;
+		
+		// send the changes of the command right away
+		command_replicate( feed, follower, db, options, std::cout );
 	}
+	
+	command_stop_autosave();
+	command_wait_saves( std::cout );
 }
 
+/// Output of a command in blocks of about 64 KiB
+typedef spsc_queue< std::string > output_blocks;
+
+/** Stream of the output of a command in a pipe session, passes the output
+ * to the writer thread in blocks while the command runs, at most a few
+ * blocks of each command are held in memory
+ */
+class command_output : public std::ostream
+{
+	
+	public:
+		
+		/// Adds the output to results, outputs are written in the order they are added
+		explicit command_output( spsc_queue< std::shared_ptr< output_blocks > >& results ) : std::ostream( nullptr ), _buffer( std::make_shared< output_blocks >( 4 ) )
+		{
+			rdbuf( &_buffer );
+			results.push( _buffer.blocks );
+		}
+		
+		~command_output() { close(); }
+		
+		/// Passes the rest of the output, the command is done
+		void close()
+		{
+			if( _buffer.blocks->closed() )
+				return;
+			_buffer.send();
+			_buffer.blocks->close();
+		}
+		
+	private:
+		
+		class block_buffer : public std::streambuf
+		{
+			
+			public:
+				
+				static constexpr size_t block_size = 65536;
+				
+				std::shared_ptr< output_blocks > blocks;
+				
+				explicit block_buffer( std::shared_ptr< output_blocks > b ) : blocks( std::move( b ) ) {}
+				
+				/// Passes the current block
+				void send()
+				{
+					if( _block.empty() )
+						return;
+					
+					blocks->push( std::move( _block ) );
+					_block.clear();
+				}
+				
+			protected:
+				
+				int_type overflow( int_type c ) override
+				{
+					if( c != traits_type::eof() )
+					{
+						char ch = traits_type::to_char_type( c );
+						xsputn( &ch, 1 );
+					}
+					return traits_type::not_eof( c );
+				}
+				
+				std::streamsize xsputn( const char* s, std::streamsize n ) override
+				{
+					_block.append( s, n );
+					if( _block.size() >= block_size )
+					{
+						send();
+						_block.reserve( block_size );
+					}
+					return n;
+				}
+				
+			private:
+				
+				std::string _block;
+				
+		};
+		
+		block_buffer _buffer;
+		
+};
+
 void pipe_session( textdb& db, std::map< std::string, std::string >& options )
 {
-	// input buffer
-	std::string input;
+	// reader thread → lines → this thread → results → writer thread
+	spsc_queue< std::string > lines( 1024 );
+	spsc_queue< std::shared_ptr< output_blocks > > results( 1024 );
 	
-	//main loop, process user input
-	while(1)
+	// reads the input in large blocks and splits it into lines
+	std::thread reader( [&lines]
 	{
-		std::getline( std::cin, input, '\n' );
+		std::string data;
+		char buffer[65536];
+		for( ssize_t length; ( length = read( STDIN_FILENO, buffer, sizeof(buffer) ) ) != 0; )
+		{
+			if( length < 0 )
+			{
+				if( errno == EINTR )
+					continue;
+				break;
+			}
+			
+			data.append( buffer, length );
+			size_t start = 0;
+			for( size_t end; ( end = data.find( '\n', start ) ) != std::string::npos; start = end+1 )
+				lines.push( data.substr( start, end - start ) );
+			data.erase( 0, start );
+		}
 		
-		if( !std::cin.bad() && !std::cin.eof() )
+		// like std::getline, an unterminated last line is not a command
+		lines.close();
+	});
+	
+	// writes the outputs of the commands in order, flushes when it has caught up
+	std::thread writer( [&results]
+	{
+		auto next = []( auto& queue, auto& value )
+		{
+			if( queue.try_pop( value ) )
+				return true;
+			if( !queue.closed() )
+				std::cout.flush();
+			return queue.pop( value );
+		};
+		
+		for( std::shared_ptr< output_blocks > blocks; next( results, blocks ); )
+		{
+			for( std::string block; next( *blocks, block ); )
+				std::cout.write( block.data(), block.size() );
+		}
+		std::cout.flush();
+	});
+	
+	// applies external changes to the opened file
+	file_watcher watcher;
+	
+	// publishes or follows changes
+	change_feed feed;
+	change_follower follower;
+	
+	std::string input, next;
+	bool have_next = false;
+	std::vector< std::string > batch;
+	std::vector< std::unique_ptr< command_output > > outputs;
+	std::vector< std::ostream* > streams;
+	while( have_next || lines.pop( input ) )
+	{
+		if( have_next )
+		{
+			input.swap( next );
+			have_next = false;
+		}
+		
+		// autosaves of the saver thread wait until the command is done
+		auto busy = lock_session();
+		
+		command_output output( results );
+		command_sync_file( watcher, db, options, output );
+		command_replicate( feed, follower, db, options, output );
+		command_background_save( db, options, output );
+		
+		// quit exits the process, everything before it has to be written first
+		if( std::regex_match( input, std::regex("(quit|close|exit)") ) )
+		{
+			output.close();
+			results.close();
+			writer.join();
 			process_input( input, db, options, std::cout );
+		}
+		
+		// consecutive read only commands that have already been read run concurrently
+		if( is_read_only_command( input ) )
+		{
+			batch.assign( 1, input );
+			while( batch.size() < 256 && lines.try_pop( next ) )
+			{
+				if( !is_read_only_command( next ) )
+				{
+					have_next = true;
+					break;
+				}
+				batch.push_back( std::move( next ) );
+			}
+			
+			// the first command also gets the messages above
+			outputs.clear();
+			streams.assign( 1, &output );
+			for( size_t i = 1; i < batch.size(); i++ )
+			{
+				outputs.push_back( std::make_unique< command_output >( results ) );
+				streams.push_back( outputs.back().get() );
+			}
+			
+			process_read_only_inputs( batch, db, options, streams, [&]( size_t i )
+			{
+				if( i == 0 )
+					output.close();
+				else
+					outputs[i-1]->close();
+			});
+		}
 		else
-			break;
+		{
+			process_input( input, db, options, output );
+			
+			// send the changes of the command right away
+			command_replicate( feed, follower, db, options, output );
+		}
 	}
+	
+	results.close();
+	writer.join();
+	reader.join();
+	
+	command_stop_autosave();
+	command_wait_saves( std::cout );
 }